@@ -0,0 +1,224 @@
+//
+// asio_append_log.hpp
+// ~~~~~~~~~~~~~~
+//
+// Group-commit append-only log. Every co_await log.append(record) joins the
+// current batch, a single writer coroutine writes the whole batch with one
+// pwritev, makes it durable with one fdatasync and resumes every waiter.
+// POSIX only, the file is preallocated with fallocate on Linux.
+//
+
+#ifndef ASIO_APPEND_LOG_HPP
+#define ASIO_APPEND_LOG_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "awaitable_tasks.hpp"
+#include "asio_blocking_pool.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/io_context.hpp"
+#include "asio/post.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/system_error.hpp"
+
+namespace awaitable {
+struct append_log_options {
+    // a batch is flushed once it holds this many records or bytes
+    size_t max_batch_records = 1024;
+    size_t max_batch_bytes = 1 << 20;
+    // how long the writer waits for a batch to fill, zero flushes as soon as it is idle
+    std::chrono::microseconds max_delay{0};
+    // the file is grown in steps of this size ahead of the write offset
+    uint64_t preallocate_bytes = 64 << 20;
+};
+
+class append_log {
+  public:
+    using options = append_log_options;
+
+    // throws asio::system_error if the file can not be opened
+    append_log(asio::io_context& io_context,
+        blocking_pool& pool,
+        const std::string& path,
+        options opts = options())
+        : _io(io_context), _pool(pool), _opts(opts), _timer(io_context) {
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (_fd < 0 || ::fstat(_fd, &st) != 0) {
+            auto ec = last_error();
+            if (_fd >= 0)
+                ::close(_fd);
+            throw asio::system_error(ec);
+        }
+        _offset = _end = _allocated = static_cast<uint64_t>(st.st_size);
+        _writer = writer_loop();
+    }
+    // all appends must have completed
+    ~append_log() {
+        AWAITTASK_ASSERT(_pending.empty() && _inflight.empty());
+        _timer.cancel();
+        _writer.reset();
+        ::close(_fd);
+    }
+    append_log(const append_log&) = delete;
+    append_log& operator=(const append_log&) = delete;
+
+    // auto ec = co_await log.append(data, size);
+    // resumes once the record is durable. data is not copied, it must stay valid until then.
+    auto append(const void* data, size_t size) {
+        _pending.push_back(record{static_cast<const char*>(data), size, {}});
+        _pending_bytes += size;
+        auto awaiter = _pending.back().handle.get_awaitable();
+        if (_idle) {
+            // posted rather than resumed inline, so appends made by the current handler join the batch
+            _idle = false;
+            asio::post(_io, [h = _wakeup]() mutable { h.resume(); });
+        } else if (_delaying && batch_full()) {
+            _timer.cancel();
+        }
+        return awaiter;
+    }
+    auto append(const std::string& record) { return append(record.data(), record.size()); }
+
+    // the bytes written as of the last completed batch
+    uint64_t size() const noexcept { return _offset; }
+
+  private:
+    struct record {
+        const char* data;
+        size_t size;
+        promise_handle<asio::error_code> handle;
+    };
+
+    static asio::error_code last_error() {
+        return asio::error_code(errno, asio::error::get_system_category());
+    }
+    bool batch_full() const noexcept {
+        return _pending.size() >= _opts.max_batch_records || _pending_bytes >= _opts.max_batch_bytes;
+    }
+
+    task<detail::Unkown> writer_loop() {
+        for (;;) {
+            if (_pending.empty()) {
+                _wakeup = promise_handle<detail::Unkown>();
+                _idle = true;
+                co_await _wakeup.get_awaitable();
+            }
+            if (_opts.max_delay.count() && !batch_full()) {
+                promise_handle<detail::Unkown> expired;
+                auto awaiter = expired.get_awaitable();
+                _delaying = true;
+                _timer.expires_after(_opts.max_delay);
+                _timer.async_wait([expired](const asio::error_code&) mutable { expired.resume(); });
+                co_await awaiter;
+                _delaying = false;
+            }
+            take_batch();
+            auto ec = co_await _pool.run(_io, [this] { return write_inflight(); });
+            // the pool thread is done with _end, its completion was posted here
+            _offset = _end;
+            for (auto& r : _inflight) {
+                r.handle.set_value(ec);
+                r.handle.resume();
+            }
+            _inflight.clear();
+        }
+    }
+
+    void take_batch() {
+        size_t count = 0;
+        size_t bytes = 0;
+        while (count < _pending.size() && count < _opts.max_batch_records &&
+               (count == 0 || bytes + _pending[count].size <= _opts.max_batch_bytes)) {
+            bytes += _pending[count].size;
+            ++count;
+        }
+        _inflight.assign(std::make_move_iterator(_pending.begin()),
+            std::make_move_iterator(_pending.begin() + count));
+        _pending.erase(_pending.begin(), _pending.begin() + count);
+        _pending_bytes -= bytes;
+        _inflight_bytes = bytes;
+    }
+
+    // runs on the blocking pool, _inflight, _end and _allocated are not
+    // touched by the io thread meanwhile
+    asio::error_code write_inflight() {
+        if (_end + _inflight_bytes > _allocated)
+            preallocate(_end + _inflight_bytes);
+        _iov.clear();
+        for (auto& r : _inflight)
+            _iov.push_back(iovec{const_cast<char*>(r.data), r.size});
+        size_t first = 0;
+        while (first < _iov.size()) {
+            int count = static_cast<int>(std::min<size_t>(_iov.size() - first, IOV_MAX));
+            ssize_t written = ::pwritev(_fd, &_iov[first], count, static_cast<off_t>(_end));
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return last_error();
+            }
+            _end += static_cast<uint64_t>(written);
+            // skip what was written, a partial write leaves the head of one iovec
+            size_t left = static_cast<size_t>(written);
+            while (first < _iov.size() && left >= _iov[first].iov_len)
+                left -= _iov[first++].iov_len;
+            if (left) {
+                _iov[first].iov_base = static_cast<char*>(_iov[first].iov_base) + left;
+                _iov[first].iov_len -= left;
+            }
+        }
+        while (::fdatasync(_fd) != 0) {
+            if (errno != EINTR)
+                return last_error();
+        }
+        return asio::error_code();
+    }
+
+    void preallocate(uint64_t end) {
+        auto step = _opts.preallocate_bytes ? _opts.preallocate_bytes : 1;
+        uint64_t target = (end + step - 1) / step * step;
+#if defined(__linux__)
+        // KEEP_SIZE keeps the file size truthful, extents are reserved so fdatasync stays cheap
+        if (::fallocate(_fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(_allocated),
+                static_cast<off_t>(target - _allocated)) != 0) {
+            _allocated = end;
+            return;
+        }
+#endif
+        _allocated = target;
+    }
+
+    asio::io_context& _io;
+    blocking_pool& _pool;
+    options _opts;
+    int _fd = -1;
+    // _offset is read by the io thread, _end is advanced by the pool thread
+    uint64_t _offset = 0;
+    uint64_t _end = 0;
+    uint64_t _allocated = 0;
+    std::vector<record> _pending;
+    size_t _pending_bytes = 0;
+    std::vector<record> _inflight;
+    size_t _inflight_bytes = 0;
+    std::vector<iovec> _iov;
+    bool _idle = false;
+    bool _delaying = false;
+    promise_handle<detail::Unkown> _wakeup;
+    asio::steady_timer _timer;
+    task<detail::Unkown> _writer;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_APPEND_LOG_HPP
@@ -0,0 +1,81 @@
+//
+// asio_blocking_pool.hpp
+// ~~~~~~~~~~~~~~
+//
+// Runs blocking calls (fdatasync, getdents64, stat...) on a few dedicated
+// threads and resumes the awaiting coroutine back on the caller's io_context.
+//
+
+#ifndef ASIO_BLOCKING_POOL_HPP
+#define ASIO_BLOCKING_POOL_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "asio/executor_work_guard.hpp"
+#include "asio/io_context.hpp"
+#include "asio/post.hpp"
+
+namespace awaitable {
+namespace detail {
+template<typename R, typename F>
+inline void invoke_into(promise_handle<R>& handle, F& func, std::false_type) {
+    handle.set_value(func());
+}
+template<typename R, typename F>
+inline void invoke_into(promise_handle<R>& handle, F& func, std::true_type) {
+    func();
+    handle.set_value(Unkown{});
+}
+}  // namespace detail
+
+class blocking_pool {
+  public:
+    explicit blocking_pool(size_t threads = 1) : _work(asio::make_work_guard(_io)) {
+        threads = threads ? threads : 1;
+        _threads.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+            _threads.emplace_back([this] { _io.run(); });
+    }
+    ~blocking_pool() {
+        _work.reset();
+        for (auto& t : _threads)
+            t.join();
+    }
+    blocking_pool(const blocking_pool&) = delete;
+    blocking_pool& operator=(const blocking_pool&) = delete;
+
+    size_t size() const noexcept { return _threads.size(); }
+    asio::io_context& get_io_context() noexcept { return _io; }
+
+    // auto ret = co_await pool.run(io_context, [fd] { return ::fdatasync(fd); });
+    // func runs on a pool thread, the caller is resumed from a handler posted to owner.
+    // func must be copyable, exceptions are delivered to the awaiting coroutine.
+    template<typename F, typename R = std::result_of_t<F()>>
+    auto run(asio::io_context& owner, F&& func) {
+        promise_handle<R> handle;
+        auto awaiter = handle.get_awaitable();
+        asio::post(_io, [&owner, handle, func{std::forward<F>(func)}]() mutable {
+            try {
+                detail::invoke_into(handle, func, std::is_void<R>{});
+            } catch (...) {
+                handle.set_exception(std::current_exception());
+            }
+            asio::post(owner, [handle]() mutable { handle.resume(); });
+        });
+        return awaiter;
+    }
+
+  private:
+    asio::io_context _io;
+    asio::executor_work_guard<asio::io_context::executor_type> _work;
+    std::vector<std::thread> _threads;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_BLOCKING_POOL_HPP
@@ -0,0 +1,513 @@
+//
+// asio_connection_pool.hpp
+// ~~~~~~~~~~~~~~
+//
+// Pooled client connections for awaitable tasks. connection_pool<Connect>
+// hands out leases on connections to an endpoint, a lease goes back to the
+// pool when it is destroyed unless it was discarded. Every endpoint has a cap
+// on its open connections; callers over it wait as suspended coroutines, in
+// order, and are handed the next connection given back or the slot of one
+// that was closed. Idle connections are checked on checkout with a
+// non-blocking peek, so one the server has closed is dropped instead of
+// failing the caller's first write, and closed once idle_timeout has passed.
+//
+// Connect opens the connections and says what they are:
+//   using endpoint_type = ...;   // ordered, the pool's key
+//   using connection_type = ...;
+//   task<std::tuple<asio::error_code, std::unique_ptr<connection_type>>>
+//       connect(const endpoint_type&);
+//   bool alive(connection_type&);  // on checkout, e.g. socket_alive()
+// tcp_connect pools plain tcp sockets.
+//
+
+#ifndef ASIO_CONNECTION_POOL_HPP
+#define ASIO_CONNECTION_POOL_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "awaitable_histogram.hpp"
+#include "asio_use_task.hpp"
+#include "asio/buffer.hpp"
+#include "asio/error.hpp"
+#include "asio/io_context.hpp"
+#include "asio/ip/tcp.hpp"
+#include "asio/post.hpp"
+#include "asio/steady_timer.hpp"
+
+namespace awaitable {
+// false when the peer has closed the socket, reset it or sent bytes nobody
+// asked for; reads nothing and does not block
+template<typename Socket>
+bool socket_alive(Socket& socket) {
+    if (!socket.is_open())
+        return false;
+    asio::error_code ec;
+    bool was_non_blocking = socket.non_blocking();
+    socket.non_blocking(true, ec);
+    if (ec)
+        return false;
+    char byte;
+    socket.receive(asio::buffer(&byte, 1), Socket::message_peek, ec);
+    asio::error_code ignored;
+    socket.non_blocking(was_non_blocking, ignored);
+    return ec == asio::error::would_block;
+}
+
+struct connection_pool_options {
+    // open connections per endpoint, leased, idle and connecting
+    size_t max_per_endpoint = 16;
+    // idle connections kept per endpoint, more are closed when given back
+    size_t max_idle = 8;
+    // idle connections older than this are closed
+    std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30);
+};
+
+class tcp_connect {
+  public:
+    using endpoint_type = asio::ip::tcp::endpoint;
+    using connection_type = asio::ip::tcp::socket;
+    using result = std::tuple<asio::error_code, std::unique_ptr<connection_type>>;
+
+    explicit tcp_connect(asio::io_context& io_context) : _io(io_context) {}
+
+    task<result> connect(const endpoint_type& endpoint) {
+        std::unique_ptr<connection_type> socket(new connection_type(_io));
+        auto ec = co_await socket->async_connect(endpoint, asio::use_task_ec);
+        if (ec)
+            return result(ec, nullptr);
+        asio::error_code ignored;
+        socket->set_option(asio::ip::tcp::no_delay(true), ignored);
+        return result(asio::error_code(), std::move(socket));
+    }
+    bool alive(connection_type& socket) { return socket_alive(socket); }
+
+  private:
+    asio::io_context& _io;
+};
+
+// Not thread safe, use one pool per io_context thread. Waiters are resumed
+// from the io_context. While connections are idle a sweep timer keeps the
+// io_context's run() going, close_idle() ends it. The pool must outlive its
+// leases and waiters.
+template<typename Connect>
+class connection_pool {
+    struct endpoint_state;
+
+  public:
+    using endpoint_type = typename Connect::endpoint_type;
+    using connection_type = typename Connect::connection_type;
+    using connection_ptr = std::unique_ptr<connection_type>;
+    using options = connection_pool_options;
+
+    class lease {
+      public:
+        lease() = default;
+        lease(lease&& rhs) noexcept
+            : _pool(rhs._pool),
+              _endpoint(rhs._endpoint),
+              _conn(std::move(rhs._conn)),
+              _reused(rhs._reused),
+              _reusable(rhs._reusable) {}
+        lease& operator=(lease&& rhs) noexcept {
+            if (this != &rhs) {
+                reset();
+                _pool = rhs._pool;
+                _endpoint = rhs._endpoint;
+                _conn = std::move(rhs._conn);
+                _reused = rhs._reused;
+                _reusable = rhs._reusable;
+            }
+            return *this;
+        }
+        ~lease() { reset(); }
+
+        connection_type& operator*() const noexcept { return *_conn; }
+        connection_type* operator->() const noexcept { return _conn.get(); }
+        connection_type* get() const noexcept { return _conn.get(); }
+        explicit operator bool() const noexcept { return _conn != nullptr; }
+        // taken from the idle connections rather than opened for this lease
+        bool reused() const noexcept { return _reused; }
+
+        // closes the connection when the lease ends, e.g. after an error that
+        // leaves it in an unknown state
+        void discard() noexcept { _reusable = false; }
+        // gives the connection back now
+        void reset() {
+            if (_conn)
+                _pool->give_back(*_endpoint, std::move(_conn), _reusable);
+            _reusable = true;
+        }
+
+      private:
+        friend class connection_pool;
+        lease(connection_pool* pool, endpoint_state* endpoint, connection_ptr conn, bool reused)
+            : _pool(pool), _endpoint(endpoint), _conn(std::move(conn)), _reused(reused) {}
+
+        connection_pool* _pool = nullptr;
+        endpoint_state* _endpoint = nullptr;
+        connection_ptr _conn;
+        bool _reused = false;
+        bool _reusable = true;
+    };
+    using result = std::tuple<asio::error_code, lease>;
+
+    template<typename... Args>
+    explicit connection_pool(asio::io_context& io_context, options opts, Args&&... args)
+        : _io(io_context), _opts(opts), _connect(std::forward<Args>(args)...), _sweep(io_context) {}
+    ~connection_pool() {
+        for (auto w : _waiter_nodes)
+            delete w;
+    }
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    // auto [ec, conn] = co_await pool.get(endpoint);
+    task<result> get(endpoint_type endpoint) {
+        auto start = std::chrono::steady_clock::now();
+        auto& ep = _endpoints[endpoint];
+        // the slot is freed when the caller fails or is reset while connecting
+        slot_guard slot{this, &ep};
+        for (;;) {
+            if (!slot.held) {
+                if (auto conn = take_idle(ep)) {
+                    record_wait(start);
+                    return result(asio::error_code(), lease(this, &ep, std::move(conn), true));
+                }
+                if (ep.open < _opts.max_per_endpoint) {
+                    ++ep.open;
+                    slot.held = true;
+                }
+            }
+            if (slot.held) {
+                auto [ec, conn] = co_await _connect.connect(endpoint);
+                if (ec)
+                    return result(ec, lease());
+                slot.held = false;
+                ++_connects;
+                record_wait(start);
+                return result(asio::error_code(), lease(this, &ep, std::move(conn), false));
+            }
+            // at the cap, wait for a connection given back or the slot of a closed one
+            ++_waits;
+            auto [ec, conn] = co_await wait_awaiter(*this, ep);
+            if (ec)
+                return result(ec, lease());
+            if (conn) {
+                record_wait(start);
+                return result(asio::error_code(), lease(this, &ep, std::move(conn), true));
+            }
+            slot.held = true;
+        }
+    }
+
+    // opens connections in the background until the endpoint has count of
+    // them, within max_per_endpoint; they go to waiters or become idle
+    void warm(const endpoint_type& endpoint, size_t count) {
+        auto& ep = _endpoints[endpoint];
+        while (ep.open < count && ep.open < _opts.max_per_endpoint) {
+            ++ep.open;
+            warm_one(endpoint, ep);
+        }
+    }
+
+    // closes idle connections older than idle_timeout, also done periodically
+    void evict_idle() {
+        auto oldest = std::chrono::steady_clock::now() - _opts.idle_timeout;
+        for (auto& p : _endpoints) {
+            auto& idle = p.second.idle;
+            size_t kept = 0;
+            for (size_t i = 0; i < idle.size(); ++i) {
+                if (idle[i].since > oldest) {
+                    if (kept != i)
+                        idle[kept] = std::move(idle[i]);
+                    ++kept;
+                    continue;
+                }
+                ++_evicted;
+                idle[i].conn.reset();
+                free_slot(p.second);
+            }
+            idle.resize(kept);
+        }
+    }
+    void close_idle() {
+        asio::error_code ignored;
+        _sweep.cancel(ignored);
+        _sweeping = false;
+        for (auto& p : _endpoints) {
+            auto count = p.second.idle.size();
+            p.second.idle.clear();
+            for (size_t i = 0; i < count; ++i)
+                free_slot(p.second);
+        }
+    }
+
+    size_t idle_connections() const noexcept {
+        size_t count = 0;
+        for (auto& p : _endpoints)
+            count += p.second.idle.size();
+        return count;
+    }
+    // leased, idle and connecting
+    size_t open_connections() const noexcept {
+        size_t count = 0;
+        for (auto& p : _endpoints)
+            count += p.second.open;
+        return count;
+    }
+    // connections opened so far
+    size_t connects() const noexcept { return _connects; }
+    // gets that had to wait at the cap
+    size_t waits() const noexcept { return _waits; }
+    // idle connections found dead on checkout
+    size_t dead() const noexcept { return _dead; }
+    // idle connections closed for their age
+    size_t evicted() const noexcept { return _evicted; }
+    // nanoseconds from get() to the lease, for gets that succeeded
+    const histogram& wait_time() const noexcept { return _wait_time; }
+
+    Connect& connector() noexcept { return _connect; }
+
+  private:
+    struct idle_connection {
+        connection_ptr conn;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    // a caller waiting at the cap; owned by the pool so that a resume posted
+    // for a caller reset meanwhile finds it
+    struct waiter : promise_base {
+        connection_pool* pool;
+        endpoint_state* endpoint = nullptr;
+        uint32_t id = 0;
+        bool queued = false;
+        asio::error_code ec;
+        // null with no error when handed a slot
+        connection_ptr conn;
+    };
+
+    struct endpoint_state {
+        std::vector<idle_connection> idle;
+        std::deque<waiter*> waiters;
+        size_t open = 0;
+    };
+
+    // an open slot taken by get() that no lease has yet
+    struct slot_guard {
+        connection_pool* pool;
+        endpoint_state* endpoint;
+        bool held = false;
+        ~slot_guard() {
+            if (held)
+                pool->free_slot(*endpoint);
+        }
+    };
+
+    using wait_result = std::tuple<asio::error_code, connection_ptr>;
+
+    struct wait_awaiter {
+        connection_pool& pool;
+        endpoint_state& endpoint;
+        waiter* pending = nullptr;
+
+        wait_awaiter(connection_pool& p, endpoint_state& ep) : pool(p), endpoint(ep) {}
+
+        bool await_ready() const noexcept { return false; }
+        template<typename P>
+        void await_suspend(coroutine<P> caller_coro) {
+            pending = pool.acquire(endpoint);
+            caller_coro.promise().insert_before(pending);
+        }
+        wait_result await_resume() {
+            wait_result ret(pending->ec, std::move(pending->conn));
+            pool.release(*pending);
+            return ret;
+        }
+    };
+
+    waiter* acquire(endpoint_state& ep) {
+        waiter* w;
+        if (_free_waiters.empty()) {
+            w = new waiter();
+            w->pool = this;
+            w->_cancel = &cancel_wait;
+            _waiter_nodes.push_back(w);
+        } else {
+            w = _free_waiters.back();
+            _free_waiters.pop_back();
+        }
+        w->endpoint = &ep;
+        w->id = ++_next_id ? _next_id : ++_next_id;
+        w->queued = true;
+        w->ec = asio::error_code();
+        ep.waiters.push_back(w);
+        return w;
+    }
+    void release(waiter& w) {
+        w.id = 0;
+        w.queued = false;
+        w.conn.reset();
+        _free_waiters.push_back(&w);
+    }
+
+    connection_ptr take_idle(endpoint_state& ep) {
+        auto oldest = std::chrono::steady_clock::now() - _opts.idle_timeout;
+        while (!ep.idle.empty()) {
+            // the most recently used first, the likeliest to be alive
+            auto entry = std::move(ep.idle.back());
+            ep.idle.pop_back();
+            if (entry.since <= oldest) {
+                ++_evicted;
+            } else if (!_connect.alive(*entry.conn)) {
+                ++_dead;
+            } else {
+                return std::move(entry.conn);
+            }
+            entry.conn.reset();
+            --ep.open;
+        }
+        return nullptr;
+    }
+
+    void give_back(endpoint_state& ep, connection_ptr conn, bool reusable) {
+        if (!reusable) {
+            conn.reset();
+            free_slot(ep);
+        } else if (!ep.waiters.empty()) {
+            hand_over(ep, std::move(conn));
+        } else if (ep.idle.size() < _opts.max_idle) {
+            ep.idle.push_back(idle_connection{std::move(conn), std::chrono::steady_clock::now()});
+            schedule_sweep();
+        } else {
+            conn.reset();
+            --ep.open;
+        }
+    }
+
+    // a closed connection's slot goes to the first waiter, who opens its own
+    void free_slot(endpoint_state& ep) {
+        if (ep.waiters.empty())
+            --ep.open;
+        else
+            hand_over(ep, nullptr);
+    }
+
+    void hand_over(endpoint_state& ep, connection_ptr conn) {
+        auto w = ep.waiters.front();
+        ep.waiters.pop_front();
+        w->queued = false;
+        w->conn = std::move(conn);
+        post_resume(*w);
+    }
+
+    void post_resume(waiter& w) {
+        auto id = w.id;
+        auto node = &w;
+        asio::post(_io, [node, id] {
+            if (node->id == id)
+                node->pool->resume(*node);
+        });
+    }
+
+    // a caller reset after it was handed something gives it back
+    void resume(waiter& w) {
+        if (promise_base::is_resumable(w.prev())) {
+            auto coro = w.prev()->_coro;
+            w.remove_from_list();
+            coro.resume();
+            return;
+        }
+        w.remove_from_list();
+        auto& ep = *w.endpoint;
+        auto conn = std::move(w.conn);
+        bool handed = !w.ec;
+        release(w);
+        if (conn)
+            give_back(ep, std::move(conn), true);
+        else if (handed)
+            free_slot(ep);
+    }
+
+    // task.cancel() resumes the caller with operation_aborted; task.reset()
+    // has already unlinked it. Once handed over, the caller gets what it was
+    // handed.
+    static void cancel_wait(promise_base* base) {
+        auto w = static_cast<waiter*>(base);
+        if (!w->queued)
+            return;
+        auto& waiters = w->endpoint->waiters;
+        for (size_t i = 0; i < waiters.size(); ++i) {
+            if (waiters[i] == w) {
+                waiters.erase(waiters.begin() + i);
+                break;
+            }
+        }
+        w->queued = false;
+        w->ec = asio::error::operation_aborted;
+        if (!w->prev())
+            w->pool->release(*w);
+        else
+            w->pool->post_resume(*w);
+    }
+
+    task<int> warm_one(endpoint_type endpoint, endpoint_state& ep) {
+        auto [ec, conn] = co_await _connect.connect(endpoint);
+        if (ec) {
+            free_slot(ep);
+            return 0;
+        }
+        ++_connects;
+        give_back(ep, std::move(conn), true);
+        return 1;
+    }
+
+    void schedule_sweep() {
+        if (_sweeping)
+            return;
+        _sweeping = true;
+        _sweep.expires_after(_opts.idle_timeout);
+        _sweep.async_wait([this](const asio::error_code& ec) {
+            if (ec == asio::error::operation_aborted)
+                return;
+            _sweeping = false;
+            evict_idle();
+            if (idle_connections())
+                schedule_sweep();
+        });
+    }
+
+    void record_wait(std::chrono::steady_clock::time_point start) {
+        auto waited = std::chrono::steady_clock::now() - start;
+        _wait_time.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()));
+    }
+
+    asio::io_context& _io;
+    options _opts;
+    Connect _connect;
+    std::map<endpoint_type, endpoint_state> _endpoints;
+    std::vector<waiter*> _waiter_nodes;
+    std::vector<waiter*> _free_waiters;
+    uint32_t _next_id = 0;
+    asio::steady_timer _sweep;
+    bool _sweeping = false;
+    size_t _connects = 0;
+    size_t _waits = 0;
+    size_t _dead = 0;
+    size_t _evicted = 0;
+    histogram _wait_time;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_CONNECTION_POOL_HPP
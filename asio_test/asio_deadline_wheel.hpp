@@ -0,0 +1,194 @@
+//
+// asio_deadline_wheel.hpp
+// ~~~~~~~~~~~~~~
+//
+// One hashed timer wheel per execution context for operation deadlines. Each
+// deadline is an intrusive entry linked into a slot, a single steady_timer
+// ticks the wheel while entries exist, so arming and disarming a deadline is
+// a couple of pointer writes instead of a timer per operation. Used by
+// asio::use_task.with_timeout(). The wheel is locked, operations on different
+// strands of a context run by several threads share it.
+//
+
+#ifndef ASIO_DEADLINE_WHEEL_HPP
+#define ASIO_DEADLINE_WHEEL_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "asio/error.hpp"
+#include "asio/execution_context.hpp"
+#include "asio/steady_timer.hpp"
+
+namespace awaitable {
+class deadline_wheel;
+
+namespace detail {
+struct deadline_entry {
+    deadline_entry* prev = nullptr;
+    deadline_entry* next = nullptr;
+    // kept after expiry so disarm still waits for a running expire callback
+    deadline_wheel* wheel = nullptr;
+    uint64_t due = 0;
+    bool linked = false;
+    // called once when the deadline passes with the wheel locked, must not
+    // complete the operation inline nor destroy the entry, e.g. by releasing
+    // the last reference to its owner
+    void (*expire)(deadline_entry*) = nullptr;
+
+    deadline_entry() = default;
+    deadline_entry(const deadline_entry&) = delete;
+    deadline_entry& operator=(const deadline_entry&) = delete;
+    inline ~deadline_entry();
+    inline void disarm() noexcept;
+};
+}  // namespace detail
+
+class deadline_wheel : public asio::execution_context::service {
+  public:
+    using clock = std::chrono::steady_clock;
+    static inline asio::execution_context::id id;
+
+    enum : uint64_t {
+        tick_ms = 4,
+        slot_count = 512,  // about two seconds per turn, longer deadlines wait for their round
+    };
+
+    explicit deadline_wheel(asio::execution_context& context)
+        : asio::execution_context::service(context) {}
+    ~deadline_wheel() { detach_all(); }
+
+    // expire runs at or after now + timeout, rounded up to the next tick
+    template<typename Executor>
+    void add(detail::deadline_entry& entry, clock::duration timeout, const Executor& executor) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_timer)
+            _timer.reset(new asio::steady_timer(executor));
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count();
+        uint64_t ticks = ms > 0 ? (static_cast<uint64_t>(ms) + tick_ms - 1) / tick_ms : 0;
+        uint64_t now = current_tick();
+        if (!_count && !_running)
+            _processed = now;
+        entry.due = now + (ticks ? ticks : 1);
+        entry.wheel = this;
+        entry.linked = true;
+        auto& head = _slots[entry.due % slot_count];
+        entry.prev = nullptr;
+        entry.next = head;
+        if (head)
+            head->prev = &entry;
+        head = &entry;
+        ++_count;
+        if (!_running)
+            schedule();
+    }
+
+    void remove(detail::deadline_entry& entry) noexcept {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // expired meanwhile on the ticking thread
+        if (entry.linked)
+            unlink(entry);
+    }
+
+    size_t size() const noexcept {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _count;
+    }
+
+  private:
+    void unlink(detail::deadline_entry& entry) noexcept {
+        if (entry.prev)
+            entry.prev->next = entry.next;
+        else
+            _slots[entry.due % slot_count] = entry.next;
+        if (entry.next)
+            entry.next->prev = entry.prev;
+        entry.prev = entry.next = nullptr;
+        entry.linked = false;
+        --_count;
+    }
+
+    static uint64_t current_tick() {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            clock::now().time_since_epoch()).count();
+        return static_cast<uint64_t>(ms) / tick_ms;
+    }
+
+    void schedule() {
+        _running = true;
+        _timer->expires_after(std::chrono::milliseconds(tick_ms));
+        _timer->async_wait([this](const asio::error_code& ec) {
+            if (ec == asio::error::operation_aborted)
+                return;
+            on_tick();
+        });
+    }
+
+    void on_tick() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_running)
+            return;
+        uint64_t now = current_tick();
+        // after a long stall one pass over every slot catches all overdue entries
+        if (now - _processed > slot_count)
+            _processed = now - slot_count;
+        while (_processed < now) {
+            ++_processed;
+            auto entry = _slots[_processed % slot_count];
+            while (entry) {
+                auto next = entry->next;
+                if (entry->due <= now) {
+                    unlink(*entry);
+                    entry->expire(entry);
+                }
+                entry = next;
+            }
+        }
+        if (_count)
+            schedule();
+        else
+            _running = false;
+    }
+
+    void detach_all() noexcept {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& head : _slots) {
+            while (auto entry = head) {
+                unlink(*entry);
+                entry->wheel = nullptr;
+            }
+        }
+    }
+
+    void shutdown() override {
+        detach_all();
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+        _timer.reset();
+    }
+
+    mutable std::mutex _mutex;
+    std::unique_ptr<asio::steady_timer> _timer;
+    detail::deadline_entry* _slots[slot_count] = {};
+    size_t _count = 0;
+    uint64_t _processed = 0;
+    bool _running = false;
+};
+
+namespace detail {
+inline deadline_entry::~deadline_entry() {
+    disarm();
+}
+inline void deadline_entry::disarm() noexcept {
+    if (wheel)
+        wheel->remove(*this);
+}
+}  // namespace detail
+}  // namespace awaitable
+
+#endif  // ASIO_DEADLINE_WHEEL_HPP
@@ -0,0 +1,414 @@
+//
+// asio_dir_walk.hpp
+// ~~~~~~~~~~~~~~
+//
+// Parallel directory walker. Directories are read with getdents64 and entries
+// stat'ed with statx on the blocking pool, a bounded number of workers share
+// the tree through per-worker deques with work stealing, and entries are
+// streamed back on the caller's io_context in batches, to a visitor or to a
+// dir_walker the caller pulls them from. Workers with nothing to do and
+// workers ahead of the consumer wait on condition variables.
+// Linux only.
+//
+
+#ifndef ASIO_DIR_WALK_HPP
+#define ASIO_DIR_WALK_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "awaitable_tasks.hpp"
+#include "asio_blocking_pool.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/executor_work_guard.hpp"
+#include "asio/io_context.hpp"
+#include "asio/post.hpp"
+
+namespace awaitable {
+struct dir_entry {
+    std::string path;
+    unsigned char type;  // DT_REG, DT_DIR, DT_LNK...
+    uint64_t inode;
+    uint64_t size;        // zero unless walk_options::stat
+    int64_t mtime_ns;     // zero unless walk_options::stat
+};
+
+struct walk_options {
+    // directories read at the same time, the blocking pool should have as many threads
+    size_t concurrency = 4;
+    // fill size and mtime with statx, otherwise only what getdents64 returns
+    bool stat = true;
+    // entries handed to the visitor at once
+    size_t batch = 256;
+    // batches queued for the consumer before the workers wait for it
+    size_t max_pending_batches = 64;
+};
+
+// error of the first directory that could not be read and the number of entries visited
+using walk_result = std::tuple<asio::error_code, size_t>;
+
+namespace detail {
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+class dir_walk_state : public std::enable_shared_from_this<dir_walk_state> {
+  public:
+    using visitor_type = std::function<void(const std::vector<dir_entry>&)>;
+    using batch_result = std::tuple<asio::error_code, std::vector<dir_entry>>;
+
+    // without a visitor the batches wait for next()
+    dir_walk_state(asio::io_context& owner, visitor_type visitor, walk_options opts)
+        : _owner(owner),
+          _work(asio::make_work_guard(owner)),
+          _visitor(std::move(visitor)),
+          _opts(opts),
+          _queues(opts.concurrency) {}
+
+    auto start(blocking_pool& pool, std::string root) {
+        auto awaiter = _handle.get_awaitable();
+        _pending_dirs = 1;
+        _queued_dirs = 1;
+        _queues[0].dirs.push_back(std::move(root));
+        _active_workers = _queues.size();
+        auto self = shared_from_this();
+        for (size_t i = 0; i < _queues.size(); ++i)
+            asio::post(pool.get_io_context(), [self, i] { self->work(i); });
+        return awaiter;
+    }
+
+    // owner thread only, one at a time
+    auto next() {
+        AWAITTASK_ASSERT(!_waiting);
+        promise_handle<batch_result> handle;
+        auto awaiter = handle.get_awaitable();
+        if (!_ready.empty() || _finished) {
+            handle.set_value(take());
+            asio::post(_owner, [handle]() mutable { handle.resume(); });
+        } else {
+            _waiting.reset(new promise_handle<batch_result>(std::move(handle)));
+        }
+        return awaiter;
+    }
+
+    // the workers drop what they have and return, from the owner thread
+    void stop() {
+        _waiting.reset();
+        _stopped.store(true, std::memory_order_release);
+        wake_all();
+    }
+
+  private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<std::string> dirs;
+    };
+
+    // own queue is used lifo for locality, thieves take the oldest (usually largest) subtree
+    bool next_dir(size_t self, std::string& dir) {
+        {
+            auto& q = _queues[self];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (!q.dirs.empty()) {
+                dir = std::move(q.dirs.back());
+                q.dirs.pop_back();
+                _queued_dirs.fetch_sub(1);
+                return true;
+            }
+        }
+        for (size_t i = 1; i < _queues.size(); ++i) {
+            auto& q = _queues[(self + i) % _queues.size()];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (!q.dirs.empty()) {
+                dir = std::move(q.dirs.front());
+                q.dirs.pop_front();
+                _queued_dirs.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        std::vector<dir_entry> batch;
+        std::vector<char> buf(1 << 16);
+        std::string dir;
+        while (!_stopped.load(std::memory_order_acquire) && _pending_dirs.load() != 0) {
+            if (!next_dir(self, dir)) {
+                // other workers still hold directories that may spawn more work
+                wait_for_dirs();
+                continue;
+            }
+            read_dir(self, dir, buf, batch);
+            if (_pending_dirs.fetch_sub(1) == 1)
+                wake_all();
+        }
+        if (!batch.empty())
+            deliver(std::move(batch));
+        if (_active_workers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            auto self_ptr = shared_from_this();
+            asio::post(_owner, [self_ptr] { self_ptr->finish(); });
+        }
+    }
+
+    // Sleeps until a directory is queued, the walk is done or stopped. The
+    // counters are sequentially consistent: a worker going idle either sees a
+    // queued directory or is seen by the one queueing it.
+    void wait_for_dirs() {
+        std::unique_lock<std::mutex> guard(_wait_lock);
+        _idle_workers.fetch_add(1);
+        _dirs_ready.wait(guard, [this] {
+            return _queued_dirs.load() != 0 || _pending_dirs.load() == 0 ||
+                   _stopped.load(std::memory_order_acquire);
+        });
+        _idle_workers.fetch_sub(1);
+    }
+
+    void wake_all() {
+        { std::lock_guard<std::mutex> guard(_wait_lock); }
+        _dirs_ready.notify_all();
+        _batch_taken.notify_all();
+    }
+
+    void read_dir(size_t self, const std::string& dir, std::vector<char>& buf,
+        std::vector<dir_entry>& batch) {
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return set_error(errno);
+        while (!_stopped.load(std::memory_order_relaxed)) {
+            long n = ::syscall(SYS_getdents64, fd, buf.data(), buf.size());
+            if (n <= 0) {
+                if (n < 0)
+                    set_error(errno);
+                break;
+            }
+            for (long off = 0; off < n;) {
+                auto d = reinterpret_cast<linux_dirent64*>(buf.data() + off);
+                off += d->d_reclen;
+                if (d->d_name[0] == '.' &&
+                    (d->d_name[1] == 0 || (d->d_name[1] == '.' && d->d_name[2] == 0)))
+                    continue;
+                dir_entry entry{dir, d->d_type, d->d_ino, 0, 0};
+                if (entry.path.back() != '/')
+                    entry.path += '/';
+                entry.path += d->d_name;
+                if (_opts.stat || entry.type == DT_UNKNOWN)
+                    stat_entry(fd, d->d_name, entry);
+                if (entry.type == DT_DIR) {
+                    _pending_dirs.fetch_add(1);
+                    {
+                        auto& q = _queues[self];
+                        std::lock_guard<std::mutex> guard(q.lock);
+                        q.dirs.push_back(entry.path);
+                        _queued_dirs.fetch_add(1);
+                    }
+                    if (_idle_workers.load() != 0) {
+                        { std::lock_guard<std::mutex> guard(_wait_lock); }
+                        _dirs_ready.notify_one();
+                    }
+                }
+                batch.push_back(std::move(entry));
+                if (batch.size() >= _opts.batch) {
+                    deliver(std::move(batch));
+                    batch.clear();
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    static void stat_entry(int dir_fd, const char* name, dir_entry& entry) {
+#if defined(STATX_BASIC_STATS)
+        struct statx stx;
+        if (::statx(dir_fd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) != 0)
+            return;
+        entry.size = stx.stx_size;
+        entry.mtime_ns = stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+        if (entry.type == DT_UNKNOWN)
+            entry.type = static_cast<unsigned char>(IFTODT(stx.stx_mode));
+#else
+        struct stat st;
+        if (::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            return;
+        entry.size = static_cast<uint64_t>(st.st_size);
+        entry.mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        if (entry.type == DT_UNKNOWN)
+            entry.type = static_cast<unsigned char>(IFTODT(st.st_mode));
+#endif
+    }
+
+    void deliver(std::vector<dir_entry>&& batch) {
+        // back pressure, a slow consumer stalls the workers instead of piling up memory
+        if (_pending_batches.load() >= _opts.max_pending_batches) {
+            std::unique_lock<std::mutex> guard(_wait_lock);
+            _blocked_workers.fetch_add(1);
+            _batch_taken.wait(guard, [this] {
+                return _pending_batches.load() < _opts.max_pending_batches ||
+                       _stopped.load(std::memory_order_acquire);
+            });
+            _blocked_workers.fetch_sub(1);
+        }
+        if (_stopped.load(std::memory_order_acquire))
+            return;
+        _pending_batches.fetch_add(1);
+        auto self = shared_from_this();
+        auto shared_batch = std::make_shared<std::vector<dir_entry>>(std::move(batch));
+        asio::post(_owner, [self, shared_batch] {
+            self->_visited += shared_batch->size();
+            if (self->_visitor) {
+                self->_visitor(*shared_batch);
+                self->batch_done();
+                return;
+            }
+            self->_ready.push_back(std::move(*shared_batch));
+            if (self->_waiting)
+                self->hand_over();
+        });
+    }
+
+    // owner thread, a batch has left the queue
+    void batch_done() {
+        if (_pending_batches.fetch_sub(1) <= _opts.max_pending_batches &&
+            _blocked_workers.load() != 0) {
+            { std::lock_guard<std::mutex> guard(_wait_lock); }
+            _batch_taken.notify_all();
+        }
+    }
+
+    batch_result take() {
+        if (_ready.empty())
+            return batch_result(_error ? _error : asio::error::eof, std::vector<dir_entry>());
+        batch_result ret(asio::error_code(), std::move(_ready.front()));
+        _ready.pop_front();
+        batch_done();
+        return ret;
+    }
+
+    void hand_over() {
+        auto handle = std::move(*_waiting);
+        _waiting.reset();
+        handle.set_value(take());
+        handle.resume();
+    }
+
+    void set_error(int err) {
+        std::lock_guard<std::mutex> guard(_error_lock);
+        if (!_error)
+            _error = asio::error_code(err, asio::error::get_system_category());
+    }
+
+    void finish() {
+        _work.reset();
+        _finished = true;
+        if (_waiting)
+            hand_over();
+        _handle.set_value(walk_result(_error, _visited));
+        _handle.resume();
+    }
+
+    asio::io_context& _owner;
+    // the walk runs on the pool, this keeps the owner's run() going meanwhile
+    asio::executor_work_guard<asio::io_context::executor_type> _work;
+    visitor_type _visitor;
+    walk_options _opts;
+    std::vector<worker_queue> _queues;
+    std::atomic<size_t> _pending_dirs{0};
+    std::atomic<size_t> _queued_dirs{0};
+    std::atomic<size_t> _active_workers{0};
+    std::atomic<size_t> _idle_workers{0};
+    std::atomic<size_t> _blocked_workers{0};
+    std::atomic<size_t> _pending_batches{0};
+    std::atomic<bool> _stopped{false};
+    std::mutex _wait_lock;
+    std::condition_variable _dirs_ready;
+    std::condition_variable _batch_taken;
+    std::mutex _error_lock;
+    asio::error_code _error;
+    promise_handle<walk_result> _handle;
+    // owner thread only
+    size_t _visited = 0;
+    bool _finished = false;
+    std::deque<std::vector<dir_entry>> _ready;
+    std::unique_ptr<promise_handle<batch_result>> _waiting;
+};
+
+inline void prepare_walk(walk_options& opts, std::string& root) {
+    opts.concurrency = opts.concurrency ? opts.concurrency : 1;
+    opts.batch = opts.batch ? opts.batch : 1;
+    opts.max_pending_batches = opts.max_pending_batches ? opts.max_pending_batches : 1;
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+}
+}  // namespace detail
+
+// auto ret = co_await awaitable::walk(io_context, pool, "/data", [](auto& entries) {...});
+// the visitor runs on io_context with batches of entries, subdirectories included.
+template<typename Visitor>
+auto walk(asio::io_context& io_context,
+    blocking_pool& pool,
+    std::string root,
+    Visitor&& visitor,
+    walk_options opts = walk_options()) {
+    detail::prepare_walk(opts, root);
+    auto state = std::make_shared<detail::dir_walk_state>(
+        io_context, std::forward<Visitor>(visitor), opts);
+    return state->start(pool, std::move(root));
+}
+
+// The walk as a sequence the caller pulls batches from:
+//     dir_walker walker(io_context, pool, "/data");
+//     for (;;) {
+//         auto [ec, entries] = co_await walker.next();
+//         if (entries.empty())
+//             break;
+//     }
+// The workers stay at most max_pending_batches ahead of next(). The last
+// call returns no entries and asio::error::eof, or the error of the first
+// directory that could not be read. Destroying the walker stops the workers.
+class dir_walker {
+  public:
+    using result = detail::dir_walk_state::batch_result;
+
+    dir_walker(asio::io_context& io_context,
+        blocking_pool& pool,
+        std::string root,
+        walk_options opts = walk_options()) {
+        detail::prepare_walk(opts, root);
+        _state = std::make_shared<detail::dir_walk_state>(
+            io_context, detail::dir_walk_state::visitor_type(), opts);
+        _state->start(pool, std::move(root));
+    }
+    ~dir_walker() { _state->stop(); }
+    dir_walker(const dir_walker&) = delete;
+    dir_walker& operator=(const dir_walker&) = delete;
+
+    // auto [ec, entries] = co_await walker.next(); on the io_context's thread
+    auto next() { return _state->next(); }
+
+  private:
+    std::shared_ptr<detail::dir_walk_state> _state;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_DIR_WALK_HPP
@@ -0,0 +1,356 @@
+//
+// asio_http_client.hpp
+// ~~~~~~~~~~~~~~
+//
+// HTTP/1.1 client for awaitable tasks. Connections are kept alive in a
+// connection_pool per host:service, resolver results are cached, responses with Content-Length,
+// chunked or close-delimited bodies are read through a socket_reader, and a
+// body can be streamed to a callback instead of collected. Several requests
+// can be pipelined on one connection. Not thread safe, use one client per
+// io_context thread.
+//
+
+#ifndef ASIO_HTTP_CLIENT_HPP
+#define ASIO_HTTP_CLIENT_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "awaitable_http.hpp"
+#include "asio_connection_pool.hpp"
+#include "asio_socket_reader.hpp"
+#include "asio_use_task.hpp"
+#include "asio/connect.hpp"
+#include "asio/error.hpp"
+#include "asio/io_context.hpp"
+#include "asio/ip/tcp.hpp"
+#include "asio/write.hpp"
+
+namespace awaitable {
+struct http_client_options {
+    // open connections per host:service, more requests wait for one
+    size_t max_per_host = 64;
+    // idle connections kept per host:service
+    size_t max_idle_per_host = 8;
+    // idle connections older than this are closed instead of reused
+    std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30);
+    std::chrono::steady_clock::duration resolve_ttl = std::chrono::seconds(60);
+    size_t read_buffer = 16 * 1024;
+};
+
+namespace detail {
+struct http_connection {
+    http_connection(asio::io_context& io_context, size_t read_buffer)
+        : socket(io_context), reader(socket, read_buffer) {}
+    asio::ip::tcp::socket socket;
+    socket_reader<asio::ip::tcp::socket> reader;
+};
+
+// opens http_connections to a (host, service), the pool's Connect
+class http_connect {
+  public:
+    using endpoint_type = std::pair<std::string, std::string>;
+    using connection_type = http_connection;
+    using result = std::tuple<asio::error_code, std::unique_ptr<connection_type>>;
+
+    http_connect(asio::io_context& io_context, const http_client_options& opts)
+        : _io(io_context), _opts(opts), _resolver(io_context) {}
+
+    task<result> connect(const endpoint_type& endpoint) {
+        auto& host = endpoint.first;
+        auto& service = endpoint.second;
+        auto key = host + ":" + service;
+        auto now = std::chrono::steady_clock::now();
+        auto cached = _resolved.find(key);
+        if (cached == _resolved.end() || cached->second.expires <= now) {
+            auto ret = co_await _resolver.async_resolve(host, service, asio::use_task_ec);
+            if (auto err = NS_VARIANT::get_if<asio::error_code>(&ret))
+                return result(*err, nullptr);
+            auto& entry = _resolved[key];
+            entry.endpoints = NS_VARIANT::get<asio::ip::tcp::resolver::results_type>(ret);
+            entry.expires = now + _opts.resolve_ttl;
+            cached = _resolved.find(key);
+        }
+        auto endpoints = cached->second.endpoints;
+        std::unique_ptr<connection_type> conn(new connection_type(_io, _opts.read_buffer));
+        auto ret = co_await asio::async_connect(conn->socket, endpoints, asio::use_task_ec);
+        if (auto err = NS_VARIANT::get_if<asio::error_code>(&ret)) {
+            // the cached address may have moved
+            _resolved.erase(key);
+            return result(*err, nullptr);
+        }
+        asio::error_code ignored;
+        conn->socket.set_option(asio::ip::tcp::no_delay(true), ignored);
+        return result(asio::error_code(), std::move(conn));
+    }
+
+    // leftover bytes mean the server sent something unasked, do not trust it
+    bool alive(connection_type& conn) {
+        return conn.reader.buffered().empty() && socket_alive(conn.socket);
+    }
+
+  private:
+    struct resolved {
+        asio::ip::tcp::resolver::results_type endpoints;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    asio::io_context& _io;
+    http_client_options _opts;
+    asio::ip::tcp::resolver _resolver;
+    std::unordered_map<std::string, resolved> _resolved;
+};
+}  // namespace detail
+
+class http_client {
+  public:
+    using result = std::tuple<asio::error_code, http_response>;
+    using pipeline_result = std::tuple<asio::error_code, std::vector<http_response>>;
+    // receives the body piece by piece, the view is valid during the call
+    using body_sink = std::function<void(byte_view)>;
+    using options = http_client_options;
+
+    explicit http_client(asio::io_context& io_context, options opts = options())
+        : _pool(io_context, pool_options(opts), io_context, opts) {}
+    http_client(const http_client&) = delete;
+    http_client& operator=(const http_client&) = delete;
+
+    // auto [ec, resp] = co_await client.request("example.com", "http", req);
+    task<result> request(std::string host, std::string service, http_request req) {
+        return request(std::move(host), std::move(service), std::move(req), body_sink());
+    }
+    task<result> request(
+        std::string host, std::string service, http_request req, body_sink sink) {
+        std::vector<http_response> responses(1);
+        auto ec = co_await exchange(host, service, &req, 1, responses.data(), sink);
+        return result(ec, std::move(responses[0]));
+    }
+
+    // requests are written back to back on one connection, the responses
+    // come back in the same order
+    task<pipeline_result> pipeline(
+        std::string host, std::string service, std::vector<http_request> reqs) {
+        std::vector<http_response> responses(reqs.size());
+        auto ec = co_await exchange(
+            host, service, reqs.data(), reqs.size(), responses.data(), body_sink());
+        return pipeline_result(ec, std::move(responses));
+    }
+
+    size_t idle_connections() const noexcept { return _pool.idle_connections(); }
+    // connections opened so far, reused ones are not counted again
+    size_t connects() const noexcept { return _pool.connects(); }
+    // waits at max_per_host, idle connections found closed, and the like
+    const connection_pool<detail::http_connect>& pool() const noexcept { return _pool; }
+
+    void close_idle() { _pool.close_idle(); }
+
+  private:
+    using connection = detail::http_connection;
+
+    static connection_pool_options pool_options(const options& opts) {
+        connection_pool_options pool_opts;
+        pool_opts.max_per_endpoint = opts.max_per_host;
+        pool_opts.max_idle = opts.max_idle_per_host;
+        pool_opts.idle_timeout = opts.idle_timeout;
+        return pool_opts;
+    }
+
+    static bool idempotent(const http_request* reqs, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            auto& m = reqs[i].method;
+            if (m != "GET" && m != "HEAD" && m != "OPTIONS" && m != "PUT" && m != "DELETE")
+                return false;
+        }
+        return true;
+    }
+    // what a server closing an idle keep-alive connection looks like
+    static bool stale(const asio::error_code& ec) {
+        return ec == asio::error::eof || ec == asio::error::connection_reset ||
+               ec == asio::error::broken_pipe || ec == asio::error::connection_aborted;
+    }
+
+    task<asio::error_code> exchange(const std::string& host, const std::string& service,
+        const http_request* reqs, size_t count, http_response* responses,
+        const body_sink& sink) {
+        std::string wire;
+        for (size_t i = 0; i < count; ++i)
+            append_request(wire, host, reqs[i]);
+        for (int attempt = 0;; ++attempt) {
+            auto [conn_ec, conn] = co_await _pool.get(std::make_pair(host, service));
+            if (conn_ec)
+                return conn_ec;
+            asio::error_code ec;
+            auto written = co_await asio::async_write(
+                conn->socket, asio::buffer(wire), asio::use_task_ec);
+            if (auto err = NS_VARIANT::get_if<asio::error_code>(&written))
+                ec = *err;
+            bool keep_alive = true;
+            size_t done = 0;
+            while (!ec && done < count) {
+                responses[done] = http_response();
+                ec = co_await read_response(*conn, reqs[done].method == "HEAD",
+                    responses[done], sink, keep_alive);
+                if (ec)
+                    break;
+                if (++done < count && !keep_alive)
+                    ec = asio::error::connection_aborted;
+            }
+            if (ec || !keep_alive)
+                conn.discard();
+            // closed by the server after the checkout, nothing was answered yet
+            if (ec && conn.reused() && done == 0 && attempt == 0 && stale(ec) &&
+                idempotent(reqs, count))
+                continue;
+            return ec;
+        }
+    }
+
+    static void append_request(
+        std::string& wire, const std::string& host, const http_request& req) {
+        wire += req.method;
+        wire += ' ';
+        wire += req.target;
+        wire += " HTTP/1.1\r\nHost: ";
+        wire += host;
+        wire += "\r\n";
+        for (auto& h : req.headers) {
+            wire += h.first;
+            wire += ": ";
+            wire += h.second;
+            wire += "\r\n";
+        }
+        if (!req.body.empty() || req.method == "POST" || req.method == "PUT") {
+            wire += "Content-Length: ";
+            wire += std::to_string(req.body.size());
+            wire += "\r\n";
+        }
+        wire += "\r\n";
+        wire += req.body;
+    }
+
+    task<asio::error_code> read_response(connection& conn, bool head_request,
+        http_response& resp, const body_sink& sink, bool& keep_alive) {
+        auto& reader = conn.reader;
+        http_response_head head;
+        // interim 1xx responses have no body, the final one follows
+        do {
+            auto [ec, data] = co_await reader.read_until("\r\n\r\n");
+            if (ec)
+                return ec;
+            if (!parse_http_response_head(data, head))
+                return asio::error::invalid_argument;
+        } while (head.status / 100 == 1);
+
+        resp.status = head.status;
+        resp.reason = head.reason.to_string();
+        resp.headers.reserve(head.header_count);
+        for (size_t i = 0; i < head.header_count; ++i)
+            resp.headers.emplace_back(
+                head.headers[i].name.to_string(), head.headers[i].value.to_string());
+
+        keep_alive = http_keep_alive(head.version, head.find("connection"));
+
+        if (head_request || head.status == 204 || head.status == 304)
+            return asio::error_code();
+        auto deliver = [&resp, &sink](byte_view piece) {
+            if (sink)
+                sink(piece);
+            else
+                resp.body.append(piece.data(), piece.size());
+        };
+        if (http_response_head::equal_nocase(head.find("transfer-encoding"), "chunked"))
+            return co_await read_chunked(reader, deliver);
+        auto length = head.find("content-length");
+        if (!length.empty()) {
+            uint64_t size = 0;
+            if (!parse_http_length(length, size))
+                return asio::error::invalid_argument;
+            return co_await read_body(reader, size, deliver);
+        }
+        // delimited by the server closing the connection
+        keep_alive = false;
+        for (;;) {
+            auto [ec, data] = co_await reader.read_some();
+            if (ec == asio::error::eof)
+                return asio::error_code();
+            if (ec)
+                return ec;
+            deliver(data);
+        }
+    }
+
+    template<typename Deliver>
+    static task<asio::error_code> read_body(
+        socket_reader<asio::ip::tcp::socket>& reader, uint64_t size, Deliver& deliver) {
+        while (size) {
+            // bytes past the body belong to the next pipelined response, leave them
+            auto [ec, data] = co_await reader.peek(1);
+            if (ec)
+                return ec;
+            size_t take = data.size() < size ? data.size() : static_cast<size_t>(size);
+            deliver(data.substr(0, take));
+            reader.consume(take);
+            size -= take;
+        }
+        return asio::error_code();
+    }
+
+    template<typename Deliver>
+    static task<asio::error_code> read_chunked(
+        socket_reader<asio::ip::tcp::socket>& reader, Deliver& deliver) {
+        for (;;) {
+            auto [ec, line] = co_await reader.read_until("\r\n");
+            if (ec)
+                return ec;
+            uint64_t size = 0;
+            size_t digits = 0;
+            for (; digits < line.size(); ++digits) {
+                int c = line[digits];
+                int v = c >= '0' && c <= '9'                  ? c - '0'
+                        : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10
+                                                                 : -1;
+                if (v < 0)
+                    break;
+                // a 17th digit would overflow the size
+                if (digits == 16)
+                    return asio::error::invalid_argument;
+                size = size * 16 + static_cast<unsigned>(v);
+            }
+            if (!digits)
+                return asio::error::invalid_argument;
+            if (size == 0)
+                break;
+            ec = co_await read_body(reader, size, deliver);
+            if (ec)
+                return ec;
+            auto [crlf_ec, crlf] = co_await reader.read_exact(2);
+            if (crlf_ec)
+                return crlf_ec;
+            if (crlf != "\r\n")
+                return asio::error::invalid_argument;
+        }
+        // trailers, up to the empty line
+        for (;;) {
+            auto [ec, line] = co_await reader.read_until("\r\n");
+            if (ec)
+                return ec;
+            if (line.size() == 2)
+                return asio::error_code();
+        }
+    }
+
+    connection_pool<detail::http_connect> _pool;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_HTTP_CLIENT_HPP
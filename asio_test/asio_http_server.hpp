@@ -0,0 +1,382 @@
+//
+// asio_http_server.hpp
+// ~~~~~~~~~~~~~~
+//
+// HTTP/1.1 server on awaitable tasks. Every worker thread runs its own
+// io_context and, where SO_REUSEPORT exists, its own acceptor on the shared
+// port, so the kernel spreads connections and a connection never leaves its
+// thread. Elsewhere the first worker accepts for all of them in turn.
+//
+// A connection is one coroutine: it parses request heads in place in its
+// socket_reader, awaits the handler's task<http_response> and keeps the
+// connection open. Requests pipelined by the client are answered in order
+// and their responses go out in one write. The connection's strings keep
+// their capacity from request to request, the head when the body has to be
+// read after it, large bodies and the pending responses, so a busy
+// connection stops allocating after its first requests. Idle connections
+// are closed after idle_timeout through the io_context's deadline_wheel.
+// stop() drains: the acceptors close, idle connections are closed and busy
+// ones answer their current request with Connection: close.
+//
+
+#ifndef ASIO_HTTP_SERVER_HPP
+#define ASIO_HTTP_SERVER_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "awaitable_http.hpp"
+#include "asio_deadline_wheel.hpp"
+#include "asio_socket_reader.hpp"
+#include "asio_use_task.hpp"
+#include "asio/error.hpp"
+#include "asio/executor_work_guard.hpp"
+#include "asio/io_context.hpp"
+#include "asio/ip/tcp.hpp"
+#include "asio/post.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/write.hpp"
+
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+#define AWAITABLE_HTTP_SERVER_REUSEPORT 1
+#endif
+
+namespace awaitable {
+struct http_server_options {
+    // worker threads, each with its own io_context
+    unsigned threads = 1;
+    // a connection waiting this long for the next request is closed
+    std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30);
+    // also the largest request head, bigger ones are answered 431
+    size_t read_buffer = 16 * 1024;
+    // larger request bodies are answered 413
+    uint64_t max_body = 1 << 20;
+};
+
+class http_server {
+  public:
+    // Called on the worker thread of the connection, handlers must be safe to
+    // run on several threads at once. The head and body are valid until the
+    // returned task completes. A status of 0 is sent as 200, an exception as 500.
+    using handler = std::function<task<http_response>(const http_request_head&, byte_view)>;
+    using options = http_server_options;
+
+    explicit http_server(handler h, options opts = options())
+        : _handler(std::move(h)), _opts(opts) {
+        unsigned threads = _opts.threads ? _opts.threads : 1;
+        for (unsigned i = 0; i < threads; ++i)
+            _workers.emplace_back(new worker());
+    }
+    ~http_server() {
+        stop();
+        join();
+    }
+    http_server(const http_server&) = delete;
+    http_server& operator=(const http_server&) = delete;
+
+    // Binds the workers' acceptors, port 0 picks a free port. Returns the
+    // bound port. Throws asio::system_error like the acceptor does.
+    unsigned short listen(asio::ip::tcp::endpoint endpoint) {
+        for (auto& w : _workers) {
+            w->acceptor.reset(new asio::ip::tcp::acceptor(w->io));
+            w->acceptor->open(endpoint.protocol());
+            w->acceptor->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(AWAITABLE_HTTP_SERVER_REUSEPORT)
+            using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+            w->acceptor->set_option(reuse_port(true));
+#endif
+            w->acceptor->bind(endpoint);
+            w->acceptor->listen();
+            endpoint.port(w->acceptor->local_endpoint().port());
+#if !defined(AWAITABLE_HTTP_SERVER_REUSEPORT)
+            break;
+#endif
+        }
+        return endpoint.port();
+    }
+
+    // starts accepting and runs the workers until stop() has drained them
+    void start() {
+        for (auto& w : _workers) {
+            if (w->acceptor)
+                accept_loop(*w);
+        }
+        for (auto& w : _workers) {
+            auto wp = w.get();
+            wp->thread = std::thread([wp] { wp->io.run(); });
+        }
+    }
+
+    // may be called from any thread, join() returns once the connections are closed
+    void stop() {
+        if (_stopping.exchange(true))
+            return;
+        for (auto& w : _workers) {
+            auto wp = w.get();
+            asio::post(wp->io, [wp] {
+                asio::error_code ignored;
+                if (wp->acceptor)
+                    wp->acceptor->close(ignored);
+                for (auto conn = wp->connections; conn; conn = conn->next_conn) {
+                    if (conn->idle)
+                        conn->socket.cancel(ignored);
+                }
+                wp->work.reset();
+            });
+        }
+    }
+
+    void join() {
+        for (auto& w : _workers) {
+            if (w->thread.joinable())
+                w->thread.join();
+        }
+    }
+
+    size_t connections() const noexcept { return _connections.load(std::memory_order_relaxed); }
+    uint64_t requests() const noexcept { return _requests.load(std::memory_order_relaxed); }
+
+  private:
+    struct connection : detail::deadline_entry {
+        connection(asio::ip::tcp::socket s, size_t read_buffer)
+            : socket(std::move(s)), reader(socket, read_buffer) {
+            expire = &on_idle;
+        }
+        asio::ip::tcp::socket socket;
+        socket_reader<asio::ip::tcp::socket> reader;
+        // the request head, copied when reading the body would move it
+        std::string head;
+        // bodies larger than the read buffer
+        std::string body;
+        // responses not written yet
+        std::string out;
+        connection* prev_conn = nullptr;
+        connection* next_conn = nullptr;
+        bool idle = false;
+    };
+
+    struct worker {
+        asio::io_context io{1};
+        asio::executor_work_guard<asio::io_context::executor_type> work{io.get_executor()};
+        std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
+        // only touched on the worker's thread
+        connection* connections = nullptr;
+        std::thread thread;
+
+        void attach(connection& conn) noexcept {
+            conn.next_conn = connections;
+            if (connections)
+                connections->prev_conn = &conn;
+            connections = &conn;
+        }
+        void detach(connection& conn) noexcept {
+            if (conn.prev_conn)
+                conn.prev_conn->next_conn = conn.next_conn;
+            else
+                connections = conn.next_conn;
+            if (conn.next_conn)
+                conn.next_conn->prev_conn = conn.prev_conn;
+        }
+    };
+
+    static void on_idle(detail::deadline_entry* entry) {
+        asio::error_code ignored;
+        static_cast<connection*>(entry)->socket.cancel(ignored);
+    }
+
+    bool draining() const noexcept { return _stopping.load(std::memory_order_relaxed); }
+
+    // the worker a new connection runs on
+    worker& next_worker(worker& acceptor_worker) noexcept {
+#if defined(AWAITABLE_HTTP_SERVER_REUSEPORT)
+        return acceptor_worker;
+#else
+        return *_workers[_next_worker++ % _workers.size()];
+#endif
+    }
+
+    task<int> accept_loop(worker& w) {
+        int accepted = 0;
+        for (;;) {
+            auto& target = next_worker(w);
+            auto ret = co_await w.acceptor->async_accept(target.io, asio::use_task_ec);
+            if (auto err = NS_VARIANT::get_if<asio::error_code>(&ret)) {
+                if (draining() || *err == asio::error::operation_aborted)
+                    return accepted;
+                // e.g. out of descriptors, try again shortly instead of spinning
+                asio::steady_timer pause(w.io, std::chrono::milliseconds(50));
+                co_await pause.async_wait(asio::use_task_ec);
+                continue;
+            }
+            ++accepted;
+            asio::ip::tcp::socket socket(std::move(NS_VARIANT::get<1>(ret)));
+            if (&target == &w) {
+                serve(w, std::move(socket));
+            } else {
+                asio::post(target.io, [this, &target, s = std::move(socket)]() mutable {
+                    serve(target, std::move(s));
+                });
+            }
+        }
+    }
+
+    task<int> serve(worker& w, asio::ip::tcp::socket socket) {
+        connection conn(std::move(socket), _opts.read_buffer);
+        w.attach(conn);
+        _connections.fetch_add(1, std::memory_order_relaxed);
+        int served = 0;
+        for (;;) {
+            // a complete head already buffered was pipelined, answer it before writing
+            if (find_crlfcrlf(conn.reader.buffered()) == byte_view::npos) {
+                if (!conn.out.empty() && !co_await flush(conn))
+                    break;
+                if (draining())
+                    break;
+                conn.idle = true;
+                asio::use_service<deadline_wheel>(w.io).add(
+                    conn, _opts.idle_timeout, w.io.get_executor());
+            }
+            auto [ec, data] = co_await conn.reader.read_until("\r\n\r\n");
+            conn.idle = false;
+            conn.disarm();
+            if (ec) {
+                if (ec == asio::error::not_found)
+                    append_error(conn.out, 431);
+                break;
+            }
+            http_request_head head;
+            if (!parse_http_request_head(data, head)) {
+                append_error(conn.out, 400);
+                break;
+            }
+            uint64_t length = 0;
+            auto length_value = head.find("content-length");
+            if (!head.find("transfer-encoding").empty()) {
+                append_error(conn.out, 501);
+                break;
+            }
+            if (!length_value.empty() && !parse_http_length(length_value, length)) {
+                append_error(conn.out, 400);
+                break;
+            }
+            if (length > _opts.max_body) {
+                append_error(conn.out, 413);
+                break;
+            }
+            if (length > conn.reader.buffered().size()) {
+                // reading on moves the buffered bytes, keep the head in the connection
+                conn.head.assign(data.data(), data.size());
+                parse_http_request_head(conn.head, head);
+            }
+            byte_view body;
+            if (length && co_await read_body(conn, static_cast<size_t>(length), body))
+                break;
+
+            bool keep_alive = http_keep_alive(head.version, head.find("connection"));
+            http_response resp;
+            try {
+                resp = co_await _handler(head, body);
+            } catch (...) {
+                resp = http_response();
+                resp.status = 500;
+            }
+            ++served;
+            _requests.fetch_add(1, std::memory_order_relaxed);
+            keep_alive = keep_alive && !draining();
+            append_response(conn.out, resp, keep_alive, head.method == "HEAD");
+            if (!keep_alive)
+                break;
+        }
+        if (!conn.out.empty())
+            co_await flush(conn);
+        asio::error_code ignored;
+        conn.socket.shutdown(asio::ip::tcp::socket::shutdown_send, ignored);
+        w.detach(conn);
+        _connections.fetch_sub(1, std::memory_order_relaxed);
+        return served;
+    }
+
+    // the view is into the reader or, past its capacity, into conn.body
+    static task<asio::error_code> read_body(connection& conn, size_t length, byte_view& body) {
+        if (length <= conn.reader.capacity()) {
+            auto [ec, data] = co_await conn.reader.read_exact(length);
+            body = data;
+            return ec;
+        }
+        conn.body.clear();
+        while (conn.body.size() < length) {
+            auto [ec, data] = co_await conn.reader.peek(1);
+            if (ec)
+                return ec;
+            size_t take = length - conn.body.size();
+            take = data.size() < take ? data.size() : take;
+            conn.body.append(data.data(), take);
+            conn.reader.consume(take);
+        }
+        body = conn.body;
+        return asio::error_code();
+    }
+
+    static task<bool> flush(connection& conn) {
+        auto written =
+            co_await asio::async_write(conn.socket, asio::buffer(conn.out), asio::use_task_ec);
+        conn.out.clear();
+        return !NS_VARIANT::get_if<asio::error_code>(&written);
+    }
+
+    static void append_response(
+        std::string& out, const http_response& resp, bool keep_alive, bool head_request) {
+        unsigned status = resp.status ? resp.status : 200;
+        out += "HTTP/1.1 ";
+        out += std::to_string(status);
+        out += ' ';
+        if (resp.reason.empty())
+            out += http_reason(status);
+        else
+            out += resp.reason;
+        out += "\r\n";
+        for (auto& h : resp.headers) {
+            out += h.first;
+            out += ": ";
+            out += h.second;
+            out += "\r\n";
+        }
+        if (status >= 200 && status != 204 && status != 304) {
+            out += "Content-Length: ";
+            out += std::to_string(resp.body.size());
+            out += "\r\n";
+        }
+        if (!keep_alive)
+            out += "Connection: close\r\n";
+        out += "\r\n";
+        if (!head_request)
+            out += resp.body;
+    }
+
+    static void append_error(std::string& out, unsigned status) {
+        http_response resp;
+        resp.status = status;
+        append_response(out, resp, false, false);
+    }
+
+    handler _handler;
+    options _opts;
+    std::vector<std::unique_ptr<worker>> _workers;
+    std::atomic<bool> _stopping{false};
+    std::atomic<size_t> _connections{0};
+    std::atomic<uint64_t> _requests{0};
+    // only used by the accepting worker
+    size_t _next_worker = 0;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_HTTP_SERVER_HPP
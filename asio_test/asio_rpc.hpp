@@ -0,0 +1,355 @@
+//
+// asio_rpc.hpp
+// ~~~~~~~~~~~~~~
+//
+// Length-prefixed binary RPC for awaitable tasks, many calls in flight on one
+// connection. A frame is a 12 byte header, payload size, call id and method
+// or status as little-endian 32 bit words, followed by the payload.
+//
+// A call takes a slot from the client's fixed table, the slot index is the
+// low half of the call id and a generation the high half, so a response is
+// matched without a search and a late one for a cancelled call is dropped.
+// The client's reader coroutine resumes the caller when the response comes.
+// Frames go through a write_queue, those queued while a handler runs, or
+// while a write is in flight, go out together in the next write. Works over
+// any stream socket, TCP and Unix domain sockets alike.
+//
+
+#ifndef ASIO_RPC_HPP
+#define ASIO_RPC_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "awaitable_buffers.hpp"
+#include "asio_socket_reader.hpp"
+#include "asio_write_queue.hpp"
+#include "asio/error.hpp"
+#include "asio/post.hpp"
+
+namespace awaitable {
+enum : uint32_t {
+    rpc_status_ok = 0,
+    // the server's handler threw
+    rpc_status_exception = 0xffffffffu,
+};
+
+struct rpc_response {
+    uint32_t status = rpc_status_ok;
+    std::string payload;
+};
+
+struct rpc_options {
+    // larger frames close the connection
+    size_t max_frame = 64 * 1024;
+    // calls a client has in flight, more fail with asio::error::no_buffer_space
+    size_t max_in_flight = 1024;
+};
+
+namespace detail {
+enum : size_t { rpc_header_size = 12 };
+
+inline void rpc_put_u32(char* p, uint32_t v) noexcept {
+    p[0] = static_cast<char>(v);
+    p[1] = static_cast<char>(v >> 8);
+    p[2] = static_cast<char>(v >> 16);
+    p[3] = static_cast<char>(v >> 24);
+}
+inline uint32_t rpc_get_u32(const char* p) noexcept {
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+// header and payload are copied to the queue and written with the frames
+// queued around them
+template<typename Stream>
+void rpc_send(write_queue<Stream>& queue, uint32_t id, uint32_t code, byte_view payload) {
+    char header[rpc_header_size];
+    rpc_put_u32(header, static_cast<uint32_t>(payload.size()));
+    rpc_put_u32(header + 4, id);
+    rpc_put_u32(header + 8, code);
+    queue.send(byte_view(header, rpc_header_size));
+    queue.send(payload);
+}
+}  // namespace detail
+
+// rpc_client<asio::local::stream_protocol::socket> for Unix domain sockets.
+// Takes a connected stream. Callers are resumed on the thread running the
+// stream's io_context. The connection is shared with its reader and writes,
+// destroying the client closes the stream, pending calls fail with the error
+// the reader gets and the rest is freed when they have completed.
+template<typename Stream = asio::ip::tcp::socket>
+class rpc_client {
+  public:
+    using result = std::tuple<asio::error_code, rpc_response>;
+
+    explicit rpc_client(Stream stream, rpc_options opts = rpc_options())
+        : _conn(std::make_shared<connection>(std::move(stream), opts)) {
+        _conn->writer.owned_by(_conn);
+        read_loop(_conn);
+    }
+    ~rpc_client() { close(); }
+    rpc_client(const rpc_client&) = delete;
+    rpc_client& operator=(const rpc_client&) = delete;
+
+    // auto [ec, resp] = co_await client.call(method, payload);
+    // payload is copied before the caller suspends
+    auto call(uint32_t method, byte_view payload) { return call_awaiter(*_conn, method, payload); }
+
+    // pending calls fail with the error the reader gets
+    void close() {
+        asio::error_code ignored;
+        _conn->stream.close(ignored);
+    }
+
+    size_t in_flight() const noexcept { return _conn->slots.size() - _conn->free.size(); }
+    size_t writes() const noexcept { return _conn->writer.writes(); }
+    Stream& stream() noexcept { return _conn->stream; }
+
+  private:
+    struct connection;
+
+    struct slot : promise_base {
+        connection* conn = nullptr;
+        // 0 while free
+        uint32_t id = 0;
+        uint16_t generation = 0;
+        asio::error_code ec;
+        rpc_response response;
+    };
+
+    struct connection : std::enable_shared_from_this<connection> {
+        connection(Stream s, const rpc_options& o)
+            : stream(std::move(s)),
+              reader(stream, o.max_frame + detail::rpc_header_size),
+              writer(stream),
+              opts(o),
+              slots(o.max_in_flight < 0x10000 ? o.max_in_flight : 0x10000) {
+            for (size_t i = slots.size(); i-- > 0;) {
+                slots[i].conn = this;
+                slots[i]._cancel = &cancel_call;
+                free.push_back(static_cast<uint32_t>(i));
+            }
+        }
+
+        slot* acquire() {
+            uint32_t index = free.back();
+            free.pop_back();
+            auto& s = slots[index];
+            if (++s.generation == 0)
+                s.generation = 1;
+            s.id = uint32_t(s.generation) << 16 | index;
+            s.ec = asio::error_code();
+            s.response.status = rpc_status_ok;
+            s.response.payload.clear();
+            return &s;
+        }
+        void release(slot& s) {
+            s.id = 0;
+            free.push_back(static_cast<uint32_t>(&s - slots.data()));
+        }
+        slot* find(uint32_t id) noexcept {
+            uint32_t index = id & 0xffff;
+            if (index >= slots.size() || slots[index].id != id)
+                return nullptr;
+            return &slots[index];
+        }
+
+        // resumes the caller, or frees the slot of a caller that was reset
+        void complete(slot& s) {
+            if (promise_base::is_resumable(s.prev())) {
+                auto coro = s.prev()->_coro;
+                s.remove_from_list();
+                coro.resume();
+            } else {
+                s.remove_from_list();
+                release(s);
+            }
+        }
+
+        void fail_all(const asio::error_code& ec) {
+            failed = ec;
+            for (auto& s : slots) {
+                if (!s.id)
+                    continue;
+                s.ec = ec;
+                s.response = rpc_response();
+                complete(s);
+            }
+        }
+
+        Stream stream;
+        socket_reader<Stream> reader;
+        write_queue<Stream> writer;
+        rpc_options opts;
+        std::vector<slot> slots;
+        std::vector<uint32_t> free;
+        asio::error_code failed;
+    };
+
+    struct call_awaiter {
+        connection& conn;
+        uint32_t method;
+        byte_view payload;
+        slot* pending = nullptr;
+        result value;
+
+        call_awaiter(connection& c, uint32_t m, byte_view p) : conn(c), method(m), payload(p) {}
+
+        bool await_ready() {
+            if (conn.failed) {
+                value = result(conn.failed, rpc_response());
+                return true;
+            }
+            if (conn.free.empty()) {
+                value = result(asio::error::no_buffer_space, rpc_response());
+                return true;
+            }
+            return false;
+        }
+        template<typename P>
+        void await_suspend(coroutine<P> caller_coro) {
+            pending = conn.acquire();
+            caller_coro.promise().insert_before(pending);
+            detail::rpc_send(conn.writer, pending->id, method, payload);
+        }
+        result await_resume() {
+            if (!pending)
+                return std::move(value);
+            result ret(pending->ec, std::move(pending->response));
+            conn.release(*pending);
+            return ret;
+        }
+    };
+
+    // task.cancel() resumes the caller with operation_aborted, later from the
+    // io_context so cancel() does not run the caller inline
+    static void cancel_call(promise_base* base) {
+        auto s = static_cast<slot*>(base);
+        auto id = s->id;
+        auto keep = s->conn->shared_from_this();
+        asio::post(keep->stream.get_executor(), [s, id, keep] {
+            if (s->id != id)
+                return;
+            s->ec = asio::error::operation_aborted;
+            s->response = rpc_response();
+            keep->complete(*s);
+        });
+    }
+
+    static task<int> read_loop(std::shared_ptr<connection> conn) {
+        int frames = 0;
+        for (;;) {
+            auto [ec, header] = co_await conn->reader.read_exact(detail::rpc_header_size);
+            if (ec) {
+                conn->fail_all(ec);
+                return frames;
+            }
+            uint32_t size = detail::rpc_get_u32(header.data());
+            uint32_t id = detail::rpc_get_u32(header.data() + 4);
+            uint32_t status = detail::rpc_get_u32(header.data() + 8);
+            if (size > conn->opts.max_frame) {
+                asio::error_code ignored;
+                conn->stream.close(ignored);
+                conn->fail_all(asio::error::message_size);
+                return frames;
+            }
+            auto [body_ec, body] = co_await conn->reader.read_exact(size);
+            if (body_ec) {
+                conn->fail_all(body_ec);
+                return frames;
+            }
+            ++frames;
+            // answered after its call was cancelled
+            auto s = conn->find(id);
+            if (!s)
+                continue;
+            s->response.status = status;
+            s->response.payload.assign(body.data(), body.size());
+            conn->complete(*s);
+        }
+    }
+
+    std::shared_ptr<connection> _conn;
+};
+
+// Answers calls on the connections given to serve(), handlers of one
+// connection run concurrently and their responses go out as they finish.
+// The server must outlive the connections.
+class rpc_server {
+  public:
+    using handler = std::function<task<rpc_response>(uint32_t method, byte_view payload)>;
+
+    explicit rpc_server(handler h, rpc_options opts = rpc_options())
+        : _handler(std::move(h)), _opts(opts) {}
+    rpc_server(const rpc_server&) = delete;
+    rpc_server& operator=(const rpc_server&) = delete;
+
+    template<typename Stream>
+    void serve(Stream stream) {
+        auto conn = std::make_shared<connection<Stream>>(std::move(stream), _opts);
+        conn->writer.owned_by(conn);
+        read_loop(std::move(conn));
+    }
+
+  private:
+    template<typename Stream>
+    struct connection {
+        connection(Stream s, const rpc_options& opts)
+            : stream(std::move(s)),
+              reader(stream, opts.max_frame + detail::rpc_header_size),
+              writer(stream) {}
+        Stream stream;
+        socket_reader<Stream> reader;
+        write_queue<Stream> writer;
+    };
+
+    template<typename Stream>
+    task<int> read_loop(std::shared_ptr<connection<Stream>> conn) {
+        int calls = 0;
+        for (;;) {
+            auto [ec, header] = co_await conn->reader.read_exact(detail::rpc_header_size);
+            if (ec)
+                return calls;
+            uint32_t size = detail::rpc_get_u32(header.data());
+            uint32_t id = detail::rpc_get_u32(header.data() + 4);
+            uint32_t method = detail::rpc_get_u32(header.data() + 8);
+            if (size > _opts.max_frame)
+                return calls;
+            auto [body_ec, body] = co_await conn->reader.read_exact(size);
+            if (body_ec)
+                return calls;
+            ++calls;
+            // the reader's buffer moves on, the call keeps its own copy
+            dispatch(conn, id, method, body.to_string());
+        }
+    }
+
+    template<typename Stream>
+    task<int> dispatch(std::shared_ptr<connection<Stream>> conn, uint32_t id, uint32_t method,
+        std::string payload) {
+        rpc_response resp;
+        try {
+            resp = co_await _handler(method, payload);
+        } catch (...) {
+            resp = rpc_response();
+            resp.status = rpc_status_exception;
+        }
+        detail::rpc_send(conn->writer, id, resp.status, resp.payload);
+        return 0;
+    }
+
+    handler _handler;
+    rpc_options _opts;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_RPC_HPP
@@ -0,0 +1,290 @@
+//
+// asio_runtime.hpp
+// ~~~~~~~~~~~~~~
+//
+// io_runtime owns one io_context per thread, each thread pinned to a core
+// where the platform allows. A task stays on its loop unless it hops with
+// co_await runtime.resume_on(index), so the loops share nothing and need no
+// strands. serve() accepts connections and places each on the loop with the
+// fewest connections, ties going to the one least busy lately, and the
+// connection's handler task runs there from then on.
+//
+// Every loop times the handlers it runs: utilization is the share of its
+// wall time spent in handlers, counted while handlers are queued, so it is
+// exact under load and reads a little low when the loop is mostly idle.
+//
+
+#ifndef ASIO_RUNTIME_HPP
+#define ASIO_RUNTIME_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "asio_use_task.hpp"
+#include "asio/error.hpp"
+#include "asio/executor_work_guard.hpp"
+#include "asio/io_context.hpp"
+#include "asio/ip/tcp.hpp"
+#include "asio/post.hpp"
+#include "asio/steady_timer.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#define AWAITABLE_RUNTIME_PIN 1
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define AWAITABLE_RUNTIME_PIN 1
+#endif
+
+namespace awaitable {
+struct io_runtime_options {
+    // loops, 0 for one per hardware thread
+    unsigned threads = 0;
+    // pins loop i to core i modulo the core count
+    bool pin = true;
+};
+
+struct io_loop_stats {
+    // nanoseconds spent running handlers and since the loop started
+    uint64_t busy_ns = 0;
+    uint64_t run_ns = 0;
+    uint64_t handlers = 0;
+    size_t connections = 0;
+    double utilization() const noexcept { return run_ns ? double(busy_ns) / double(run_ns) : 0.0; }
+};
+
+class io_runtime {
+  public:
+    using options = io_runtime_options;
+
+    explicit io_runtime(options opts = options()) : _opts(opts) {
+        unsigned threads = _opts.threads ? _opts.threads : std::thread::hardware_concurrency();
+        threads = threads ? threads : 1;
+        for (unsigned i = 0; i < threads; ++i)
+            _loops.emplace_back(new loop(i));
+    }
+    // Stops the loops at once, accepts and connections still open are
+    // abandoned and their tasks destroyed with the io_contexts. stop() and
+    // join() first to let them finish.
+    ~io_runtime() {
+        for (auto& l : _loops)
+            l->io.stop();
+        join();
+    }
+    io_runtime(const io_runtime&) = delete;
+    io_runtime& operator=(const io_runtime&) = delete;
+
+    size_t size() const noexcept { return _loops.size(); }
+    asio::io_context& context(size_t index) noexcept { return _loops[index]->io; }
+
+    void start() {
+        for (auto& l : _loops) {
+            auto lp = l.get();
+            lp->thread = std::thread([this, lp] { run(*lp); });
+            if (_opts.pin)
+                pin(*lp);
+        }
+    }
+
+    // the loops finish the work they have and return, may be called from any thread
+    void stop() {
+        for (auto& l : _loops) {
+            auto lp = l.get();
+            asio::post(lp->io, [lp] { lp->work.reset(); });
+        }
+    }
+
+    void join() {
+        for (auto& l : _loops) {
+            if (l->thread.joinable())
+                l->thread.join();
+        }
+    }
+
+    // the loop running on this thread, -1 on other threads
+    int current() const noexcept {
+        auto l = current_loop();
+        return l && l->runtime == this ? static_cast<int>(l->index) : -1;
+    }
+
+    // co_await runtime.resume_on(i); continues on loop i, at once when already there.
+    // A reset on loop i before it arrives destroys the task, the hop then
+    // resumes nothing; cancel() does not stop it.
+    auto resume_on(size_t index) { return hop_awaiter{*this, index}; }
+
+    // the loop a new connection should go to
+    size_t least_loaded() const noexcept {
+        size_t start = _next.fetch_add(1, std::memory_order_relaxed) % _loops.size();
+        size_t best = start;
+        for (size_t n = 1; n < _loops.size(); ++n) {
+            size_t i = (start + n) % _loops.size();
+            if (load(*_loops[i]) < load(*_loops[best]))
+                best = i;
+        }
+        return best;
+    }
+
+    // Accepts until the acceptor fails or closes. Each connection is accepted
+    // straight into the least loaded loop and handler(socket) runs there,
+    // counted against the loop until its task finishes.
+    template<typename Handler>
+    task<size_t> serve(asio::ip::tcp::acceptor& acceptor, Handler handler) {
+        size_t accepted = 0;
+        for (;;) {
+            auto& target = *_loops[least_loaded()];
+            auto ret = co_await acceptor.async_accept(target.io, asio::use_task_ec);
+            if (auto err = NS_VARIANT::get_if<asio::error_code>(&ret)) {
+                if (*err == asio::error::operation_aborted || !acceptor.is_open())
+                    return accepted;
+                // e.g. out of descriptors, try again shortly instead of spinning
+                asio::steady_timer pause(acceptor.get_executor(), std::chrono::milliseconds(50));
+                co_await pause.async_wait(asio::use_task_ec);
+                continue;
+            }
+            ++accepted;
+            target.connections.fetch_add(1, std::memory_order_relaxed);
+            auto lp = &target;
+            asio::post(target.io, [lp, handler, s = std::move(NS_VARIANT::get<1>(ret))]() mutable {
+                run_connection(*lp, handler, std::move(s));
+            });
+        }
+    }
+
+    io_loop_stats stats(size_t index) const noexcept {
+        auto& l = *_loops[index];
+        io_loop_stats s;
+        s.busy_ns = l.busy_ns.load(std::memory_order_relaxed);
+        s.run_ns = l.run_ns.load(std::memory_order_relaxed);
+        s.handlers = l.handlers.load(std::memory_order_relaxed);
+        s.connections = l.connections.load(std::memory_order_relaxed);
+        return s;
+    }
+
+  private:
+    struct loop {
+        explicit loop(size_t i) : index(i), io(1), work(asio::make_work_guard(io)) {}
+        size_t index;
+        io_runtime* runtime = nullptr;
+        asio::io_context io;
+        asio::executor_work_guard<asio::io_context::executor_type> work;
+        std::thread thread;
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> run_ns{0};
+        std::atomic<uint64_t> handlers{0};
+        std::atomic<size_t> connections{0};
+        // permille busy over the last window, for placement
+        std::atomic<unsigned> recent{0};
+    };
+
+    struct hop_awaiter {
+        io_runtime& runtime;
+        size_t index;
+
+        bool await_ready() const noexcept {
+            return runtime.current() == static_cast<int>(index);
+        }
+        // the task links to the handle, a reset unlinks it
+        template<typename P>
+        void await_suspend(coroutine<P> caller_coro) {
+            promise_handle<void> handle;
+            caller_coro.promise().insert_before(handle._state.get());
+            asio::post(runtime.context(index), [handle]() mutable { handle.resume(); });
+        }
+        void await_resume() const noexcept {}
+    };
+
+    static loop*& current_loop() noexcept {
+        thread_local loop* l = nullptr;
+        return l;
+    }
+
+    static unsigned load(const loop& l) noexcept {
+        // a connection outweighs any difference in utilization
+        return static_cast<unsigned>(l.connections.load(std::memory_order_relaxed)) * 1000 +
+               l.recent.load(std::memory_order_relaxed);
+    }
+
+    // poll() runs what is queued and is timed as busy, run_one() then waits
+    // for more; the handler it runs after the wait counts as idle
+    void run(loop& l) {
+        using clock = std::chrono::steady_clock;
+        l.runtime = this;
+        current_loop() = &l;
+        auto started = clock::now();
+        auto window = started;
+        uint64_t window_busy = 0;
+        uint64_t busy = 0;
+        for (;;) {
+            auto before = clock::now();
+            size_t n = l.io.poll();
+            auto after = clock::now();
+            if (n) {
+                busy += static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count());
+                l.handlers.fetch_add(n, std::memory_order_relaxed);
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(after - started);
+            l.busy_ns.store(busy, std::memory_order_relaxed);
+            l.run_ns.store(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+            if (after - window >= std::chrono::milliseconds(100)) {
+                auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(after - window);
+                l.recent.store(static_cast<unsigned>((busy - window_busy) * 1000 /
+                                                     static_cast<uint64_t>(wall.count())),
+                    std::memory_order_relaxed);
+                window = after;
+                window_busy = busy;
+            }
+            if (l.io.stopped())
+                break;
+            if (!n) {
+                if (!l.io.run_one())
+                    break;
+                l.handlers.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        current_loop() = nullptr;
+    }
+
+    template<typename Handler>
+    static task<int> run_connection(loop& l, Handler handler, asio::ip::tcp::socket socket) {
+        try {
+            co_await handler(std::move(socket));
+        } catch (...) {
+        }
+        l.connections.fetch_sub(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    static void pin(loop& l) {
+#if defined(AWAITABLE_RUNTIME_PIN)
+        unsigned cores = std::thread::hardware_concurrency();
+        unsigned core = static_cast<unsigned>(l.index % (cores ? cores : 1));
+#if defined(_WIN32)
+        SetThreadAffinityMask(l.thread.native_handle(), DWORD_PTR(1) << core);
+#else
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        pthread_setaffinity_np(l.thread.native_handle(), sizeof(set), &set);
+#endif
+#else
+        (void)l;
+#endif
+    }
+
+    options _opts;
+    std::vector<std::unique_ptr<loop>> _loops;
+    mutable std::atomic<size_t> _next{0};
+};
+}  // namespace awaitable
+
+#endif  // ASIO_RUNTIME_HPP
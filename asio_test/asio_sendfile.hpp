@@ -0,0 +1,305 @@
+//
+// asio_sendfile.hpp
+// ~~~~~~~~~~~~~~
+//
+// Zero-copy transfers for awaitable tasks. send_file moves file data to a
+// socket with sendfile(2), splice moves data between a socket or pipe and a
+// file, or two of them, through the kernel pipe buffers. Partial transfers
+// and EAGAIN are handled inside the operation, waiting through the stream's
+// own async_wait, the awaiting coroutine is resumed once on completion or
+// error. Linux only.
+//
+
+#ifndef ASIO_SENDFILE_HPP
+#define ASIO_SENDFILE_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <algorithm>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "awaitable_tasks.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/any_io_executor.hpp"
+#include "asio/post.hpp"
+
+namespace awaitable {
+// error and the number of bytes that reached the destination
+using transfer_result = std::tuple<asio::error_code, size_t>;
+
+namespace detail {
+class transfer_op_base {
+  public:
+    explicit transfer_op_base(const asio::any_io_executor& executor) : _executor(executor) {}
+
+  protected:
+    static asio::error_code last_error() {
+        return asio::error_code(errno, asio::error::get_system_category());
+    }
+    // completing during initiation is posted, the caller has not suspended yet
+    void complete(const asio::error_code& ec) {
+        _handle.set_value(transfer_result(ec, _transferred));
+        if (_initiating) {
+            auto handle = _handle;
+            asio::post(_executor, [handle]() mutable { handle.resume(); });
+        } else {
+            _handle.resume();
+        }
+    }
+
+    asio::any_io_executor _executor;
+    promise_handle<transfer_result> _handle;
+    size_t _transferred = 0;
+    bool _initiating = true;
+};
+
+// a socket or stream_descriptor splice reads or writes, waited for with its
+// own async_wait so its reactor registration is reused
+template<typename Stream>
+class stream_end {
+  public:
+    explicit stream_end(Stream& stream) : _stream(stream) {}
+    int fd() { return _stream.native_handle(); }
+    void prepare(asio::error_code& ec) { _stream.native_non_blocking(true, ec); }
+    template<typename Handler>
+    bool wait(bool for_read, Handler&& handler) {
+        _stream.async_wait(for_read ? Stream::wait_read : Stream::wait_write,
+            std::forward<Handler>(handler));
+        return true;
+    }
+
+  private:
+    Stream& _stream;
+};
+
+// a regular file, always ready, never waited for
+class file_end {
+  public:
+    explicit file_end(int fd) : _fd(fd) {}
+    int fd() { return _fd; }
+    void prepare(asio::error_code&) {}
+    template<typename Handler>
+    bool wait(bool, Handler&&) {
+        return false;
+    }
+
+  private:
+    int _fd;
+};
+
+template<typename Socket>
+class send_file_op : public transfer_op_base,
+                     public std::enable_shared_from_this<send_file_op<Socket>> {
+  public:
+    send_file_op(Socket& socket, int fd, off_t offset, size_t len)
+        : transfer_op_base(socket.get_executor()),
+          _socket(socket),
+          _fd(fd),
+          _offset(offset),
+          _remaining(len) {}
+
+    auto start() {
+        auto awaiter = _handle.get_awaitable();
+        asio::error_code ec;
+        _socket.native_non_blocking(true, ec);
+        if (ec)
+            complete(ec);
+        else
+            run();
+        _initiating = false;
+        return awaiter;
+    }
+
+  private:
+    void run() {
+        while (_remaining) {
+            ssize_t n = ::sendfile(_socket.native_handle(), _fd, &_offset,
+                std::min(_remaining, static_cast<size_t>(max_chunk)));
+            if (n > 0) {
+                _transferred += static_cast<size_t>(n);
+                _remaining -= static_cast<size_t>(n);
+            } else if (n == 0) {
+                // the file is shorter than requested
+                return complete(asio::error::eof);
+            } else if (errno == EAGAIN) {
+                auto self = this->shared_from_this();
+                _socket.async_wait(Socket::wait_write,
+                    [self](const asio::error_code& ec) {
+                        if (ec)
+                            self->complete(ec);
+                        else
+                            self->run();
+                    });
+                return;
+            } else if (errno != EINTR) {
+                return complete(last_error());
+            }
+        }
+        complete(asio::error_code());
+    }
+
+    static constexpr size_t max_chunk = 1 << 30;
+    Socket& _socket;
+    int _fd;
+    off_t _offset;
+    size_t _remaining;
+};
+
+template<typename In, typename Out>
+class splice_op : public transfer_op_base,
+                  public std::enable_shared_from_this<splice_op<In, Out>> {
+  public:
+    splice_op(const asio::any_io_executor& executor, In in, Out out, size_t len)
+        : transfer_op_base(executor),
+          _in(in),
+          _out(out),
+          _in_fd(_in.fd()),
+          _out_fd(_out.fd()),
+          _remaining(len) {}
+    ~splice_op() {
+        if (_pipe[0] >= 0) {
+            ::close(_pipe[0]);
+            ::close(_pipe[1]);
+        }
+    }
+
+    auto start() {
+        auto awaiter = _handle.get_awaitable();
+        struct stat in_st, out_st;
+        asio::error_code ec;
+        _in.prepare(ec);
+        if (!ec)
+            _out.prepare(ec);
+        if (ec) {
+            complete(ec);
+        } else if (::fstat(_in_fd, &in_st) != 0 || ::fstat(_out_fd, &out_st) != 0) {
+            complete(last_error());
+        } else {
+            // splice needs a pipe on one side, otherwise data goes through a private pipe
+            _direct = S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode);
+            if (!_direct && ::pipe2(_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+                complete(last_error());
+            } else {
+                if (!_direct) {
+                    int size = ::fcntl(_pipe[1], F_SETPIPE_SZ, 1 << 20);
+                    _chunk = size > 0 ? static_cast<size_t>(size) : 1 << 16;
+                }
+                run();
+            }
+        }
+        _initiating = false;
+        return awaiter;
+    }
+
+  private:
+    void run() {
+        const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE;
+        for (;;) {
+            if (_in_pipe) {
+                ssize_t n = ::splice(_pipe[0], nullptr, _out_fd, nullptr, _in_pipe, flags);
+                if (n > 0) {
+                    _in_pipe -= static_cast<size_t>(n);
+                    _transferred += static_cast<size_t>(n);
+                } else if (n < 0 && errno == EAGAIN) {
+                    return wait(false);
+                } else if (n == 0 || errno != EINTR) {
+                    return complete(n == 0 ? asio::error::broken_pipe : last_error());
+                }
+                continue;
+            }
+            if (!_remaining)
+                return complete(asio::error_code());
+            ssize_t n = ::splice(_in_fd, nullptr, _direct ? _out_fd : _pipe[1], nullptr,
+                std::min(_remaining, _chunk), flags);
+            if (n > 0) {
+                _remaining -= static_cast<size_t>(n);
+                (_direct ? _transferred : _in_pipe) += static_cast<size_t>(n);
+            } else if (n == 0) {
+                return complete(asio::error::eof);
+            } else if (errno == EAGAIN) {
+                // our own pipe was drained, so only a direct splice can be blocked by the output
+                return wait(!_direct || !output_blocked());
+            } else if (errno != EINTR) {
+                return complete(last_error());
+            }
+        }
+    }
+
+    bool output_blocked() const {
+        pollfd pfd{_out_fd, POLLOUT, 0};
+        return ::poll(&pfd, 1, 0) == 0;
+    }
+
+    void wait(bool for_input) {
+        auto self = this->shared_from_this();
+        auto handler = [self](const asio::error_code& ec) {
+            if (ec)
+                self->complete(ec);
+            else
+                self->run();
+        };
+        // a file never blocks, the other end did
+        if (!wait_on(for_input, handler) && !wait_on(!for_input, handler))
+            complete(asio::error::operation_not_supported);
+    }
+    template<typename Handler>
+    bool wait_on(bool input, Handler& handler) {
+        return input ? _in.wait(true, handler) : _out.wait(false, handler);
+    }
+
+    In _in;
+    Out _out;
+    int _in_fd;
+    int _out_fd;
+    size_t _remaining;
+    size_t _chunk = 1 << 30;
+    size_t _in_pipe = 0;
+    bool _direct = true;
+    int _pipe[2] = {-1, -1};
+};
+
+template<typename In, typename Out>
+auto start_splice(const asio::any_io_executor& executor, In in, Out out, size_t len) {
+    return std::make_shared<splice_op<In, Out>>(executor, in, out, len)->start();
+}
+}  // namespace detail
+
+// auto ret = co_await awaitable::send_file(socket, fd, offset, len);
+// sends len bytes of fd starting at offset, the file position is left untouched.
+template<typename Socket>
+auto send_file(Socket& socket, int fd, off_t offset, size_t len) {
+    return std::make_shared<detail::send_file_op<Socket>>(socket, fd, offset, len)->start();
+}
+
+// auto ret = co_await awaitable::splice(socket, file_fd, len);
+// Sockets and pipes are given as asio objects, a pipe as a
+// posix::stream_descriptor, and are made non-blocking. A plain descriptor
+// must be a regular file, read or written at its current position.
+template<typename Stream, typename = std::enable_if_t<std::is_class<Stream>::value>>
+auto splice(Stream& in, int out_file, size_t len) {
+    return detail::start_splice(
+        in.get_executor(), detail::stream_end<Stream>(in), detail::file_end(out_file), len);
+}
+template<typename Stream, typename = std::enable_if_t<std::is_class<Stream>::value>>
+auto splice(int in_file, Stream& out, size_t len) {
+    return detail::start_splice(
+        out.get_executor(), detail::file_end(in_file), detail::stream_end<Stream>(out), len);
+}
+template<typename In, typename Out,
+    typename = std::enable_if_t<std::is_class<In>::value && std::is_class<Out>::value>>
+auto splice(In& in, Out& out, size_t len) {
+    return detail::start_splice(
+        in.get_executor(), detail::stream_end<In>(in), detail::stream_end<Out>(out), len);
+}
+}  // namespace awaitable
+
+#endif  // ASIO_SENDFILE_HPP
@@ -0,0 +1,138 @@
+//
+// asio_socket_chunks.hpp
+// ~~~~~~~~~~~~~~
+//
+// A socket's input as a stream of pooled buffer chunks for awaitable tasks.
+// Each co_await chunks.next() returns the bytes of one read in a buffer_slice
+// the consumer may keep, its chunk goes back to the pool when the last slice
+// of it is gone. One read runs ahead of the consumer: when a chunk is taken
+// the read of the next one is started before the consumer processes it. The
+// stream reuses one waiter and one handler allocation for all its reads.
+//
+
+#ifndef ASIO_SOCKET_CHUNKS_HPP
+#define ASIO_SOCKET_CHUNKS_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <memory>
+#include <tuple>
+#include "awaitable_tasks.hpp"
+#include "awaitable_buffers.hpp"
+#include "awaitable_handler_memory.hpp"
+#include "asio/buffer.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/ip/tcp.hpp"
+
+namespace awaitable {
+// The stream and pool must outlive the socket_chunks, and the pool must be
+// used on the thread running the stream's io_context, e.g. buffer_pool::local().
+// Destroying it cancels the read ahead, with the stream's other operations.
+template<typename Stream = asio::ip::tcp::socket>
+class socket_chunks {
+  public:
+    using result = std::tuple<asio::error_code, buffer_slice>;
+
+    explicit socket_chunks(Stream& stream, buffer_pool& pool = buffer_pool::local())
+        : _state(std::make_shared<state>(stream, pool)) {
+        _state->start_read(_state);
+    }
+    ~socket_chunks() {
+        _state->owner_gone = true;
+        if (_state->reading) {
+            asio::error_code ignored;
+            _state->stream.cancel(ignored);
+        }
+    }
+    socket_chunks(const socket_chunks&) = delete;
+    socket_chunks& operator=(const socket_chunks&) = delete;
+
+    // auto [ec, chunk] = co_await chunks.next();
+    // one at a time; the end of the stream is asio::error::eof, and the error
+    // that ended it is returned again by later calls
+    auto next() { return next_awaiter{_state}; }
+
+  private:
+    // the read in flight and what the awaiting task links to, shared with
+    // the read handler so a completion after the destructor finds it
+    struct state : promise_base {
+        state(Stream& s, buffer_pool& p) : stream(s), pool(p) { _cancel = &cancel_read; }
+
+        Stream& stream;
+        buffer_pool& pool;
+        buffer_slice chunk;
+        bool reading = false;
+        // chunk holds a read the consumer has not taken yet
+        bool ready = false;
+        // the socket_chunks is destroyed, no read is started after the last
+        bool owner_gone = false;
+        asio::error_code ec;
+        handler_memory memory;
+
+        void start_read(const std::shared_ptr<state>& self) {
+            chunk = pool.allocate();
+            reading = true;
+            stream.async_read_some(
+                asio::buffer(chunk.data(), chunk.capacity()), read_handler{self});
+        }
+
+        // hands over the finished read and starts the next, unless it failed
+        // or the socket_chunks is gone
+        result take(const std::shared_ptr<state>& self) {
+            ready = false;
+            result ret(ec, std::move(chunk));
+            if (!ec && !owner_gone)
+                start_read(self);
+            return ret;
+        }
+
+        void on_read(const asio::error_code& error, size_t n) {
+            reading = false;
+            ready = true;
+            ec = error;
+            chunk.resize(n);
+            if (promise_base::is_resumable(prev())) {
+                auto coro = prev()->_coro;
+                remove_from_list();
+                coro.resume();
+            }
+        }
+
+        static void cancel_read(promise_base* base) {
+            asio::error_code ignored;
+            static_cast<state*>(base)->stream.cancel(ignored);
+        }
+    };
+
+    struct read_handler {
+        using allocator_type = handler_allocator<void>;
+        std::shared_ptr<state> self;
+        allocator_type get_allocator() const noexcept { return allocator_type(self->memory); }
+        void operator()(const asio::error_code& ec, size_t n) { self->on_read(ec, n); }
+    };
+
+    // holds the state, the socket_chunks may be destroyed while it waits
+    struct next_awaiter {
+        std::shared_ptr<state> self;
+
+        bool await_ready() const noexcept { return self->ready || !self->reading; }
+        template<typename P>
+        void await_suspend(coroutine<P> caller_coro) {
+            AWAITTASK_ASSERT(!self->prev());  // one next() at a time
+            caller_coro.promise().insert_before(self.get());
+        }
+        result await_resume() {
+            if (!self->ready)
+                return result(self->ec, buffer_slice());
+            return self->take(self);
+        }
+    };
+
+    std::shared_ptr<state> _state;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_SOCKET_CHUNKS_HPP
@@ -0,0 +1,233 @@
+//
+// asio_socket_reader.hpp
+// ~~~~~~~~~~~~~~
+//
+// Buffered reads for awaitable tasks. A socket_reader owns one fixed buffer,
+// read_until, read_exact, read_some and peek return views into it instead of
+// copying into a streambuf. A delimiter scan resumes where the previous one
+// stopped, CRLF and CRLFCRLF are found with the vectorized scanners. Requests
+// already satisfied by buffered bytes complete without suspending, and the
+// awaiters and handlers reuse memory owned by the reader, so a parser looping
+// over a connection does not allocate. The buffer lives in a state shared
+// with the read in flight, destroying the reader or resetting the awaiting
+// task cancels that read alone and it completes into the state.
+//
+
+#ifndef ASIO_SOCKET_READER_HPP
+#define ASIO_SOCKET_READER_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include "awaitable_tasks.hpp"
+#include "awaitable_buffers.hpp"
+#include "awaitable_handler_memory.hpp"
+#include "awaitable_http.hpp"
+#include "asio/buffer.hpp"
+#include "asio/cancellation_signal.hpp"
+#include "asio/cancellation_type.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/ip/tcp.hpp"
+
+namespace awaitable {
+template<typename Stream = asio::ip::tcp::socket>
+class socket_reader {
+  public:
+    using result = std::tuple<asio::error_code, byte_view>;
+
+    explicit socket_reader(Stream& stream, size_t capacity = 16 * 1024)
+        : _stream(stream), _state(std::make_shared<state>(this, capacity)), _capacity(capacity) {}
+    ~socket_reader() {
+        _state->reader = nullptr;
+        _state->signal.emit(asio::cancellation_type::all);
+    }
+    socket_reader(const socket_reader&) = delete;
+    socket_reader& operator=(const socket_reader&) = delete;
+
+    // One read at a time. A returned view, and the data of every earlier one,
+    // is valid until the next read; copy what has to outlive it.
+
+    // auto [ec, line] = co_await reader.read_until("\r\n");
+    // line ends with the delimiter. Fails with asio::error::not_found when the
+    // buffer fills up without one, or with eof, leaving the rest buffered.
+    auto read_until(byte_view delim) { return read_awaiter(*this, op_until, delim, 0); }
+
+    // exactly n bytes, asio::error::no_buffer_space when n exceeds the capacity
+    auto read_exact(size_t n) { return read_awaiter(*this, op_exact, byte_view(), n); }
+
+    // whatever is buffered, reading from the stream first when nothing is
+    auto read_some() { return read_awaiter(*this, op_some, byte_view(), 1); }
+
+    // at least n buffered bytes, none of them consumed
+    auto peek(size_t n = 1) { return read_awaiter(*this, op_peek, byte_view(), n); }
+
+    // drops bytes returned by peek
+    void consume(size_t n) noexcept {
+        n = n < buffered_size() ? n : buffered_size();
+        _begin += n;
+        _scanned = 0;
+    }
+
+    byte_view buffered() const noexcept {
+        return byte_view(data() + _begin, buffered_size());
+    }
+    size_t capacity() const noexcept { return _capacity; }
+    Stream& stream() noexcept { return _stream; }
+
+  private:
+    enum op_kind { op_until, op_exact, op_some, op_peek };
+
+    // what the awaiting task links to, reused by every read, and the buffer,
+    // shared with the read handler so a completion after the destructor finds it
+    struct state : promise_base {
+        state(socket_reader* r, size_t capacity) : reader(r), buffer(new char[capacity]) {
+            _cancel = &cancel_read;
+        }
+        // cleared by the destructor
+        socket_reader* reader;
+        std::unique_ptr<char[]> buffer;
+        asio::cancellation_signal signal;
+        handler_memory memory;
+    };
+
+    struct read_awaiter {
+        socket_reader& reader;
+        op_kind kind;
+        byte_view delim;
+        size_t size;
+        result value;
+
+        read_awaiter(socket_reader& r, op_kind k, byte_view d, size_t n)
+            : reader(r), kind(k), delim(d), size(n) {}
+
+        bool await_ready() { return reader.try_complete(*this); }
+        template<typename P>
+        void await_suspend(coroutine<P> caller_coro) {
+            AWAITTASK_ASSERT(!reader._state->prev());  // one read at a time
+            caller_coro.promise().insert_before(reader._state.get());
+            reader._pending = this;
+            reader.start_read();
+        }
+        result await_resume() { return std::move(value); }
+    };
+
+    struct read_handler {
+        using allocator_type = handler_allocator<void>;
+        using cancellation_slot_type = asio::cancellation_slot;
+        std::shared_ptr<state> self;
+        allocator_type get_allocator() const noexcept { return allocator_type(self->memory); }
+        cancellation_slot_type get_cancellation_slot() const noexcept {
+            return self->signal.slot();
+        }
+        void operator()(const asio::error_code& ec, size_t n) {
+            self->signal.slot().clear();
+            if (self->reader)
+                self->reader->on_read(ec, n);
+        }
+    };
+
+    char* data() const noexcept { return _state->buffer.get(); }
+
+    size_t buffered_size() const noexcept { return _end - _begin; }
+
+    // fills in op.value when the buffered bytes answer the request
+    bool try_complete(read_awaiter& op) {
+        auto data = this->data() + _begin;
+        size_t size = buffered_size();
+        switch (op.kind) {
+        case op_until: {
+            size_t dsize = op.delim.size();
+            // the delimiter may straddle the end of the previous scan
+            size_t from = _scanned >= dsize ? _scanned - dsize + 1 : 0;
+            size_t pos = find_delimiter(byte_view(data, size), op.delim, from);
+            if (pos == byte_view::npos) {
+                _scanned = size;
+                if (size == _capacity)
+                    return fail(op, asio::error::not_found);
+                return false;
+            }
+            return take(op, pos + dsize);
+        }
+        case op_exact:
+            if (op.size > _capacity)
+                return fail(op, asio::error::no_buffer_space);
+            return size >= op.size && take(op, op.size);
+        case op_some:
+            return size && take(op, size);
+        case op_peek:
+            if (op.size > _capacity)
+                return fail(op, asio::error::no_buffer_space);
+            if (size < op.size)
+                return false;
+            op.value = result(asio::error_code(), byte_view(data, size));
+            return true;
+        }
+        return false;
+    }
+    bool take(read_awaiter& op, size_t n) {
+        op.value = result(asio::error_code(), byte_view(data() + _begin, n));
+        _begin += n;
+        _scanned = 0;
+        return true;
+    }
+    bool fail(read_awaiter& op, const asio::error_code& ec) {
+        op.value = result(ec, byte_view());
+        _scanned = 0;
+        return true;
+    }
+
+    void start_read() {
+        // the views handed out before this read are released, move the rest to the front
+        if (_begin) {
+            std::memmove(data(), data() + _begin, buffered_size());
+            _end -= _begin;
+            _begin = 0;
+        }
+        _stream.async_read_some(
+            asio::buffer(data() + _end, _capacity - _end), read_handler{_state});
+    }
+
+    void on_read(const asio::error_code& ec, size_t n) {
+        _end += n;
+        auto op = _pending;
+        if (!_state->prev()) {
+            // the awaiting task was reset, the bytes stay buffered
+            _pending = nullptr;
+            return;
+        }
+        if (ec) {
+            fail(*op, ec);
+        } else if (!try_complete(*op)) {
+            start_read();
+            return;
+        }
+        _pending = nullptr;
+        if (promise_base::is_resumable(_state->prev())) {
+            auto coro = _state->prev()->_coro;
+            _state->remove_from_list();
+            coro.resume();
+        }
+    }
+
+    // only this read, other operations on the stream go on
+    static void cancel_read(promise_base* base) {
+        static_cast<state*>(base)->signal.emit(asio::cancellation_type::all);
+    }
+
+    Stream& _stream;
+    std::shared_ptr<state> _state;
+    size_t _capacity;
+    size_t _begin = 0;
+    size_t _end = 0;
+    // bytes from _begin already searched for the pending delimiter
+    size_t _scanned = 0;
+    read_awaiter* _pending = nullptr;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_SOCKET_READER_HPP
@@ -0,0 +1,326 @@
+//
+// asio_udp_batch.hpp
+// ~~~~~~~~~~~~~~
+//
+// Batched datagram i/o for awaitable tasks. One co_await receives or sends a
+// whole batch through recvmmsg/sendmmsg, coalescing with UDP GRO/GSO where the
+// kernel supports it. Received datagrams hold pooled buffer slices, so they
+// can be kept or handed to other coroutines without copying. Linux only.
+//
+
+#ifndef ASIO_UDP_BATCH_HPP
+#define ASIO_UDP_BATCH_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include "awaitable_tasks.hpp"
+#include "awaitable_buffers.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/ip/udp.hpp"
+#include "asio/post.hpp"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace awaitable {
+struct datagram {
+    const char* data;
+    size_t size;
+    asio::ip::udp::endpoint endpoint;
+    // keeps a received payload alive, empty for datagrams built by the caller
+    buffer_slice buffer;
+};
+
+class datagram_span {
+  public:
+    datagram_span() = default;
+    datagram_span(const datagram* first, size_t count) : _first(first), _count(count) {}
+    const datagram* begin() const noexcept { return _first; }
+    const datagram* end() const noexcept { return _first + _count; }
+    const datagram& operator[](size_t idx) const noexcept { return _first[idx]; }
+    size_t size() const noexcept { return _count; }
+    bool empty() const noexcept { return _count == 0; }
+
+  private:
+    const datagram* _first = nullptr;
+    size_t _count = 0;
+};
+
+struct udp_batch_options {
+    // messages per recvmmsg/sendmmsg call
+    size_t batch = 64;
+    // receive buffer per message, raised to 64k when gro is on
+    size_t datagram_size = 2048;
+    bool gro = true;
+    bool gso = true;
+};
+
+class udp_batch_socket {
+  public:
+    using receive_result = std::tuple<asio::error_code, datagram_span>;
+    using send_result = std::tuple<asio::error_code, size_t>;
+
+    using options = udp_batch_options;
+
+    explicit udp_batch_socket(asio::ip::udp::socket& socket, options opts = options())
+        : _socket(socket), _opts(opts) {
+        _opts.batch = _opts.batch ? _opts.batch : 1;
+        int on = 1;
+        if (_opts.gro &&
+            ::setsockopt(_socket.native_handle(), SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0)
+            _opts.gro = false;
+        _msg_size = _opts.gro ? 65536 : _opts.datagram_size;
+        _rx_buffers.resize(_opts.batch);
+        _rx_msgs.resize(_opts.batch);
+        _rx_iov.resize(_opts.batch);
+        _rx_names.resize(_opts.batch);
+        _rx_control.resize(_opts.batch * control_size);
+    }
+    udp_batch_socket(const udp_batch_socket&) = delete;
+    udp_batch_socket& operator=(const udp_batch_socket&) = delete;
+
+    // auto ret = co_await sock.receive_batch();
+    // the span is valid until the next receive, copy a datagram to keep its payload longer.
+    auto receive_batch() {
+        promise_handle<receive_result> handle;
+        auto awaiter = handle.get_awaitable();
+        start_receive(std::move(handle));
+        return awaiter;
+    }
+
+    // auto ret = co_await sock.send_batch(msgs, count);
+    // completes once every datagram was handed to the kernel, or on the first error.
+    auto send_batch(const datagram* msgs, size_t count) {
+        promise_handle<send_result> handle;
+        auto awaiter = handle.get_awaitable();
+        _tx_first = msgs;
+        _tx_count = count;
+        _tx_sent = 0;
+        start_send(std::move(handle));
+        return awaiter;
+    }
+    auto send_batch(const std::vector<datagram>& msgs) { return send_batch(msgs.data(), msgs.size()); }
+
+    asio::ip::udp::socket& socket() noexcept { return _socket; }
+
+  private:
+    static constexpr size_t control_size = CMSG_SPACE(sizeof(int));
+
+    static asio::error_code last_error() {
+        return asio::error_code(errno, asio::error::get_system_category());
+    }
+    static bool would_block(const asio::error_code& ec) {
+        return ec == asio::error::would_block || ec == asio::error::try_again;
+    }
+    template<typename T>
+    void complete_later(promise_handle<T>& handle, T value) {
+        handle.set_value(std::move(value));
+        asio::post(_socket.get_executor(), [handle]() mutable { handle.resume(); });
+    }
+
+    void start_receive(promise_handle<receive_result> handle) {
+        asio::error_code ec = try_receive();
+        if (!would_block(ec)) {
+            complete_later(handle, receive_result(ec, datagram_span(_rx_out.data(), _rx_out.size())));
+            return;
+        }
+        _socket.async_wait(asio::socket_base::wait_read,
+            [this, handle](const asio::error_code& err) mutable {
+                if (err) {
+                    handle.set_value(receive_result(err, datagram_span()));
+                    handle.resume();
+                    return;
+                }
+                start_receive(std::move(handle));
+            });
+    }
+
+    asio::error_code try_receive() {
+        // chunks still referenced by kept datagrams are replaced, the others are reused
+        _rx_out.clear();
+        auto& pool = buffer_pool::local(_msg_size);
+        for (size_t i = 0; i < _opts.batch; ++i) {
+            auto& buffer = _rx_buffers[i];
+            if (!buffer.unique())
+                buffer = pool.allocate();
+            auto& hdr = _rx_msgs[i].msg_hdr;
+            std::memset(&hdr, 0, sizeof(hdr));
+            _rx_iov[i] = iovec{buffer.data(), std::min(buffer.capacity(), _msg_size)};
+            hdr.msg_iov = &_rx_iov[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_name = &_rx_names[i];
+            hdr.msg_namelen = sizeof(sockaddr_storage);
+            if (_opts.gro) {
+                hdr.msg_control = &_rx_control[i * control_size];
+                hdr.msg_controllen = control_size;
+            }
+        }
+        int n;
+        do {
+            n = ::recvmmsg(_socket.native_handle(), _rx_msgs.data(),
+                static_cast<unsigned>(_opts.batch), MSG_DONTWAIT, nullptr);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+            return last_error();
+        for (int i = 0; i < n; ++i) {
+            auto& hdr = _rx_msgs[i].msg_hdr;
+            asio::ip::udp::endpoint from;
+            std::memcpy(from.data(), hdr.msg_name, hdr.msg_namelen);
+            from.resize(hdr.msg_namelen);
+            const auto& buffer = _rx_buffers[i];
+            size_t len = _rx_msgs[i].msg_len;
+            // with gro one message carries several datagrams of segment size, the last may be shorter
+            size_t segment = len;
+            for (auto cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    int gso_size;
+                    std::memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                    if (gso_size > 0)
+                        segment = static_cast<size_t>(gso_size);
+                }
+            }
+            if (len == 0)
+                _rx_out.push_back(datagram{buffer.data(), 0, from, buffer.slice(0, 0)});
+            for (size_t off = 0; off < len; off += segment) {
+                auto payload = buffer.slice(off, std::min(segment, len - off));
+                _rx_out.push_back(datagram{payload.data(), payload.size(), from, payload});
+            }
+        }
+        return asio::error_code();
+    }
+
+    void start_send(promise_handle<send_result> handle) {
+        asio::error_code ec = try_send();
+        if (!would_block(ec)) {
+            complete_later(handle, send_result(ec, _tx_sent));
+            return;
+        }
+        _socket.async_wait(asio::socket_base::wait_write,
+            [this, handle](const asio::error_code& err) mutable {
+                if (err) {
+                    handle.set_value(send_result(err, _tx_sent));
+                    handle.resume();
+                    return;
+                }
+                start_send(std::move(handle));
+            });
+    }
+
+    // runs of datagrams to one peer with the same size go out as one gso message
+    size_t build_send_batch() {
+        _tx_msgs.clear();
+        _tx_iov.clear();
+        _tx_segments.clear();
+        _tx_control.assign(_opts.batch * control_size, 0);
+        // reserved up front so the msg_iov pointers stay valid while filling
+        _tx_iov.reserve(_tx_count - _tx_sent);
+        size_t idx = _tx_sent;
+        while (idx < _tx_count && _tx_msgs.size() < _opts.batch) {
+            const auto& first = _tx_first[idx];
+            size_t run = 1;
+            size_t bytes = first.size;
+            if (_opts.gso) {
+                while (idx + run < _tx_count && run < max_gso_segments) {
+                    const auto& next = _tx_first[idx + run];
+                    if (!(next.endpoint == first.endpoint) || next.size > first.size ||
+                        bytes + next.size > max_gso_bytes ||
+                        _tx_first[idx + run - 1].size != first.size)
+                        break;
+                    bytes += next.size;
+                    ++run;
+                }
+            }
+            const size_t iov_first = _tx_iov.size();
+            for (size_t i = 0; i < run; ++i) {
+                const auto& d = _tx_first[idx + i];
+                _tx_iov.push_back(iovec{const_cast<char*>(d.data), d.size});
+            }
+            mmsghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_hdr.msg_name = const_cast<void*>(static_cast<const void*>(first.endpoint.data()));
+            msg.msg_hdr.msg_namelen = static_cast<socklen_t>(first.endpoint.size());
+            msg.msg_hdr.msg_iov = &_tx_iov[iov_first];
+            msg.msg_hdr.msg_iovlen = run;
+            if (run > 1) {
+                auto& control = _tx_control[_tx_msgs.size() * control_size];
+                msg.msg_hdr.msg_control = &control;
+                msg.msg_hdr.msg_controllen = control_size;
+                auto cm = CMSG_FIRSTHDR(&msg.msg_hdr);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = static_cast<uint16_t>(first.size);
+                std::memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+            }
+            _tx_msgs.push_back(msg);
+            _tx_segments.push_back(run);
+            idx += run;
+        }
+        return _tx_msgs.size();
+    }
+
+    asio::error_code try_send() {
+        while (_tx_sent < _tx_count) {
+            const size_t count = build_send_batch();
+            int n;
+            do {
+                n = ::sendmmsg(_socket.native_handle(), _tx_msgs.data(),
+                    static_cast<unsigned>(count), MSG_DONTWAIT);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                auto ec = last_error();
+                // kernels without UDP_SEGMENT reject the cmsg, fall back to one datagram per message
+                if (_opts.gso && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT)) {
+                    _opts.gso = false;
+                    continue;
+                }
+                return ec;
+            }
+            for (int i = 0; i < n; ++i)
+                _tx_sent += _tx_segments[i];
+        }
+        return asio::error_code();
+    }
+
+    static constexpr size_t max_gso_segments = 64;
+    static constexpr size_t max_gso_bytes = 65000;
+
+    asio::ip::udp::socket& _socket;
+    options _opts;
+
+    size_t _msg_size;
+    std::vector<buffer_slice> _rx_buffers;
+    std::vector<mmsghdr> _rx_msgs;
+    std::vector<iovec> _rx_iov;
+    std::vector<sockaddr_storage> _rx_names;
+    std::vector<char> _rx_control;
+    std::vector<datagram> _rx_out;
+
+    const datagram* _tx_first = nullptr;
+    size_t _tx_count = 0;
+    size_t _tx_sent = 0;
+    std::vector<mmsghdr> _tx_msgs;
+    std::vector<iovec> _tx_iov;
+    std::vector<size_t> _tx_segments;
+    std::vector<char> _tx_control;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_UDP_BATCH_HPP
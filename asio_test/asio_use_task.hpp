@@ -16,41 +16,72 @@
 #endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
 
 #include "awaitable_tasks.hpp"
+#include "asio_deadline_wheel.hpp"
 #include "asio/detail/config.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <tuple>
+#include <utility>
 
 #include "asio/detail/push_options.hpp"
+#include "asio/any_io_executor.hpp"
+#include "asio/as_tuple.hpp"
 #include "asio/async_result.hpp"
+#include "asio/cancellation_signal.hpp"
+#include "asio/cancellation_type.hpp"
 #include "asio/error_code.hpp"
-#include "asio/handler_type.hpp"
+#include "asio/execution/context.hpp"
+#include "asio/post.hpp"
+#include "asio/query.hpp"
 #include "asio/system_error.hpp"
-
-#define ASIO_TASK_VARIANT
-//#define ASIO_TASK_EXCEPTION
+#include "asio/system_executor.hpp"
 
 namespace asio {
 
+/// How a use_task operation reports failure.
+namespace task_mode {
+/// The error is thrown as asio::system_error, the task resolves to the value.
+struct throws {};
+/// The task resolves to NS_VARIANT::variant<asio::error_code, T>, or to the
+/// error_code for operations without a value. Nothing is thrown.
+struct returns {};
+}  // namespace task_mode
+
 /// Class used to specify that an asynchronous operation should return a task.
 /**
 * The use_task_t class is used to indicate that an asynchronous operation
-* should return a task object. A use_task_t object may be passed as a
-* handler to an asynchronous operation, typically using the special value @c
-* asio::use_task. For example:
+* should return an awaitable. A use_task_t object may be passed as a
+* completion token to an asynchronous operation, typically using the special
+* values @c asio::use_task or @c asio::use_task_ec. For example:
+*
+* @code std::size_t n
+*   = co_await my_socket.async_read_some(my_buffer, asio::use_task); @endcode
 *
-* @code std::task<std::size_t> my_task
-*   = my_socket.async_read_some(my_buffer, asio::use_task); @endcode
+* The initiating function (async_read_some in the above example) returns an
+* awaitable that starts the operation when it is awaited. An operation that
+* completes during initiation, e.g. async_read_until on data already in the
+* streambuf, continues the task straight away instead of through the
+* io_context's queue. How a failure is delivered is chosen per call site:
 *
-* The initiating function (async_read_some in the above example) returns a
-* task that will receive the result of the operation. If the operation
-* completes with an error_code indicating failure, it is converted into a
-* system_error and passed back to the caller via the task.
+* @li @c asio::use_task throws asio::system_error.
+* @li @c asio::use_task_ec returns variant<error_code, T>.
+* @li @c asio::as_tuple(asio::use_task) returns std::tuple<error_code, T>.
 */
-template<typename Allocator = std::allocator<void>>
+template<typename Allocator, typename Mode>
+class timed_use_task_t;
+template<typename Token, typename Executor>
+class bound_use_task_t;
+
+template<typename Allocator = std::allocator<void>, typename Mode = task_mode::throws>
 class use_task_t {
   public:
-    /// The allocator type. The allocator is used when constructing the
-    /// @c std::promise object for a given asynchronous operation.
+    /// The allocator type. The allocator is used for the shared state of each
+    /// operation and, through the handler's associated allocator, for asio's
+    /// operation object.
     typedef Allocator allocator_type;
+    typedef Mode mode_type;
 
     /// Construct using default-constructed allocator.
     ASIO_CONSTEXPR use_task_t() {}
@@ -60,179 +91,592 @@ class use_task_t {
 
     /// Specify an alternate allocator.
     template<typename OtherAllocator>
-    use_task_t<OtherAllocator> operator[](const OtherAllocator& allocator) const {
-        return use_task_t<OtherAllocator>(allocator);
+    use_task_t<OtherAllocator, Mode> operator[](const OtherAllocator& allocator) const {
+        return use_task_t<OtherAllocator, Mode>(allocator);
     }
 
     /// Obtain allocator.
     allocator_type get_allocator() const { return _allocator; }
 
+    /// Cancel the operation if it has not completed within timeout, it then
+    /// fails with asio::error::timed_out in the token's mode.
+    template<typename Rep, typename Period>
+    timed_use_task_t<Allocator, Mode> with_timeout(
+        std::chrono::duration<Rep, Period> timeout) const {
+        return timed_use_task_t<Allocator, Mode>(*this, timeout);
+    }
+
+    /// Resume the awaiting task through executor, e.g. the strand of its
+    /// connection, see bound_use_task_t.
+    template<typename Executor>
+    bound_use_task_t<use_task_t, Executor> on(const Executor& executor) const {
+        return bound_use_task_t<use_task_t, Executor>(*this, executor);
+    }
+
   private:
     Allocator _allocator;
 };
 
-/// A special value, similar to std::nothrow.
+/// A use_task token with a per-operation deadline, see use_task_t::with_timeout.
+/**
+* The deadline is an entry in the execution context's deadline_wheel, no timer
+* or extra frame is created per operation. The operation's initiation must
+* provide get_executor(), as asio's own operations do. The cancellation on
+* expiry is posted to that executor, on a context run by several threads bind
+* the token to the operation's strand with on().
+*
+* @code auto n = co_await asio::async_read_until(socket, buf, "\r\n",
+*     asio::use_task_ec.with_timeout(std::chrono::milliseconds(200))); @endcode
+*/
+template<typename Allocator, typename Mode>
+class timed_use_task_t {
+  public:
+    typedef Allocator allocator_type;
+    typedef Mode mode_type;
+
+    timed_use_task_t(
+        const use_task_t<Allocator, Mode>& token, std::chrono::steady_clock::duration timeout)
+        : _token(token), _timeout(timeout) {}
+
+    /// Specify an alternate allocator.
+    template<typename OtherAllocator>
+    timed_use_task_t<OtherAllocator, Mode> operator[](const OtherAllocator& allocator) const {
+        return timed_use_task_t<OtherAllocator, Mode>(_token[allocator], _timeout);
+    }
+
+    allocator_type get_allocator() const { return _token.get_allocator(); }
+    std::chrono::steady_clock::duration timeout() const { return _timeout; }
+
+    /// Resume the awaiting task through executor, see bound_use_task_t.
+    template<typename Executor>
+    bound_use_task_t<timed_use_task_t, Executor> on(const Executor& executor) const {
+        return bound_use_task_t<timed_use_task_t, Executor>(*this, executor);
+    }
+
+  private:
+    use_task_t<Allocator, Mode> _token;
+    std::chrono::steady_clock::duration _timeout;
+};
+
+/// A use_task token that resumes the awaiting task through an executor.
+/**
+* The executor becomes the completion handler's associated executor, asio
+* then runs the completion, and so the rest of the task up to its next await,
+* inline when the completing thread is already running in the executor and
+* posts it there otherwise. With io_context::run() on several threads, a task
+* started on a strand and awaiting with that strand's token never runs on two
+* threads at once. Reset or cancel such a task from its strand as well.
+*
+* @code asio::dispatch(strand, [&] { session(socket, strand); });
+* ...
+* auto n = co_await socket.async_read_some(buf, asio::use_task.on(strand)); @endcode
+*/
+template<typename Token, typename Executor>
+class bound_use_task_t {
+  public:
+    typedef typename Token::allocator_type allocator_type;
+    typedef typename Token::mode_type mode_type;
+    typedef Executor executor_type;
+
+    bound_use_task_t(const Token& token, const Executor& executor)
+        : _token(token), _executor(executor) {}
+
+    /// Specify an alternate allocator.
+    template<typename OtherAllocator>
+    auto operator[](const OtherAllocator& allocator) const {
+        using other_token = decltype(_token[allocator]);
+        return bound_use_task_t<other_token, Executor>(_token[allocator], _executor);
+    }
+
+    allocator_type get_allocator() const { return _token.get_allocator(); }
+    executor_type get_executor() const { return _executor; }
+    const Token& token() const { return _token; }
+
+  private:
+    Token _token;
+    Executor _executor;
+};
+
+/// Special values, similar to std::nothrow.
 /**
 * See the documentation for asio::use_task_t for a usage example.
 */
-#if defined(ASIO_HAS_CONSTEXPR) || defined(GENERATING_DOCUMENTATION)
-// constexpr use_task_t<> use_task;
-// #elif defined(ASIO_MSVC)
+#if defined(ASIO_MSVC)
 #pragma warning(push)
 #pragma warning(disable : 4592)
 __declspec(selectany) use_task_t<> use_task;
+__declspec(selectany) use_task_t<std::allocator<void>, task_mode::returns> use_task_ec;
 #pragma warning(pop)
+#else
+static const use_task_t<> use_task;
+static const use_task_t<std::allocator<void>, task_mode::returns> use_task_ec;
 #endif
 
 namespace detail {
 
-// Completion handler to adapt a promise as a completion handler.
+// Result type of an operation and how its completion is stored, per mode.
+template<typename Mode, typename T>
+struct task_result;
+
+template<typename T>
+struct task_result<task_mode::throws, T> {
+    using type = T;
+    template<typename Handle>
+    static void set(Handle& handle, const asio::error_code& ec, T&& value) {
+        if (ec)
+            handle.set_exception(std::make_exception_ptr(asio::system_error(ec)));
+        else
+            handle.set_value(std::move(value));
+    }
+};
+
 template<typename T>
-class promise_handler {
+struct task_result<task_mode::returns, T> {
+    using type = NS_VARIANT::variant<asio::error_code, T>;
+    template<typename Handle>
+    static void set(Handle& handle, const asio::error_code& ec, T&& value) {
+        if (ec)
+            handle.set_value(type(ec));
+        else
+            handle.set_value(type(std::move(value)));
+    }
+};
+
+template<>
+struct task_result<task_mode::throws, void> {
+    using type = asio::error_code;
+    template<typename Handle>
+    static void set(Handle& handle, const asio::error_code& ec) {
+        if (ec)
+            handle.set_exception(std::make_exception_ptr(asio::system_error(ec)));
+        else
+            handle.set_value(ec);
+    }
+};
+
+template<>
+struct task_result<task_mode::returns, void> {
+    using type = asio::error_code;
+    template<typename Handle>
+    static void set(Handle& handle, const asio::error_code& ec) {
+        handle.set_value(ec);
+    }
+};
+
+// Where an operation is between initiation and completion. Whoever moves the
+// phase second continues the awaiting task: the handler resumes it, or, for a
+// completion that arrived while the operation was still being initiated,
+// await_suspend returns false.
+enum task_phase : uint8_t {
+    task_phase_initiating,
+    task_phase_armed,
+    task_phase_completed,
+};
+
+// Shared state of an operation. Resetting or cancelling the awaiting task
+// emits the signal, asio then completes the operation with operation_aborted,
+// after a reset into this state alone, the frames are gone by then.
+template<typename Result>
+struct task_op_state : ::awaitable::promise_handle<Result>::shared_state {
+    task_op_state() { this->_cancel = &emit_cancel; }
+    static void emit_cancel(::awaitable::promise_base* base) {
+        static_cast<task_op_state*>(base)->signal.emit(asio::cancellation_type::all);
+    }
+    asio::cancellation_signal signal;
+    std::atomic<uint8_t> phase{task_phase_initiating};
+};
+
+// State of an operation with a deadline, the wheel entry cancels it on expiry
+// and the completion reports timed_out instead of operation_aborted. The wheel
+// ticks on any thread of the context, the cancellation is posted to the
+// operation's executor. With several threads running the context only a
+// strand orders it after the completion, bind the token with on(strand).
+template<typename Result>
+struct task_timed_state : task_op_state<Result>, ::awaitable::detail::deadline_entry {
+    task_timed_state() { this->expire = &on_expire; }
+    ~task_timed_state() { this->disarm(); }
+    static void on_expire(::awaitable::detail::deadline_entry* entry) {
+        auto state = static_cast<task_timed_state*>(entry);
+        state->timed_out.store(true, std::memory_order_release);
+        // the wheel is locked, the last reference must not be dropped here
+        if (auto keep = state->self.lock())
+            asio::post(state->io_executor, [keep = std::move(keep)] { keep->cancel(); });
+    }
+    std::chrono::steady_clock::duration timeout{};
+    std::atomic<bool> timed_out{false};
+    // the executor of the I/O object, set when the operation is armed
+    asio::any_io_executor io_executor;
+    std::weak_ptr<task_timed_state> self;
+};
+
+// Deadline of an operation bound to an executor, the cancellation goes
+// through that executor instead.
+template<typename Result, typename Executor>
+struct task_bound_timed_state : task_timed_state<Result> {
+    explicit task_bound_timed_state(const Executor& ex) : executor(ex) {
+        this->expire = &on_expire;
+    }
+    ~task_bound_timed_state() { this->disarm(); }
+    static void on_expire(::awaitable::detail::deadline_entry* entry) {
+        auto state = static_cast<task_bound_timed_state*>(entry);
+        state->timed_out.store(true, std::memory_order_release);
+        // the wheel is locked, the last reference must not be dropped here
+        if (auto keep = state->self.lock())
+            asio::post(state->executor, [keep = std::move(keep)] { keep->cancel(); });
+    }
+    Executor executor;
+};
+
+template<typename Result, bool Timed, typename Executor>
+struct task_state_for {
+    using type = task_op_state<Result>;
+};
+
+template<typename Result, typename Executor>
+struct task_state_for<Result, true, Executor> {
+    using type = task_bound_timed_state<Result, Executor>;
+};
+
+template<typename Result>
+struct task_state_for<Result, true, void> {
+    using type = task_timed_state<Result>;
+};
+
+// Associated executor of a handler whose token was bound with on(executor).
+template<typename Executor>
+class task_handler_executor {
   public:
-#if defined(ASIO_TASK_VARIANT)
-    using result_type_t = NS_VARIANT::variant<asio::error_code, T>;
-#elif defined(ASIO_TASK_EXCEPTION)
-    using result_type_t = T;
-#else
-    using result_type_t = std::tuple<asio::error_code, T>;
-#endif
+    typedef Executor executor_type;
 
-    using promise_type = awaitable::promise_handle<result_type_t>;
-    // Construct from use_task special value.
-    template<typename Allocator>
-    promise_handler(use_task_t<Allocator> /*uf*/) {}
-    promise_handler(const promise_handler&) = delete;
-    promise_handler& operator=(const promise_handler&) = delete;
-    promise_handler(promise_handler&&) = default;
-    promise_handler& operator=(promise_handler&&) = default;
+    template<typename Token>
+    explicit task_handler_executor(const Token& token) : _executor(token.get_executor()) {}
 
-    void operator()(T t) {
-#if defined(ASIO_TASK_VARIANT) || defined(ASIO_TASK_EXCEPTION)
-        _promise_handle.set_value(std::move(t));
-#else
-        _promise_handle.set_value(result_type_t(asio::error_code(), std::move(t)));
-#endif
-        _promise_handle.resume();
+    executor_type get_executor() const noexcept { return _executor; }
+
+  protected:
+    // executor whose context owns the deadline wheel
+    template<typename Initiation>
+    const Executor& context_executor(const Initiation&) const {
+        return _executor;
     }
-    void operator()(const asio::error_code& ec, T t) {
-#if defined(ASIO_TASK_VARIANT)
-        if (ec) {
-            _promise_handle.set_value(std::move(ec));
-        } else {
-            _promise_handle.set_value(std::move(t));
-        }
-#elif defined(ASIO_TASK_EXCEPTION)
-        if (ec) {
-            _promise_handle.set_exception(std::make_exception_ptr(asio::system_error(ec)));
-        } else {
-            _promise_handle.set_value(std::move(t));
-        }
-#else
-        _promise_handle.set_value(result_type_t(ec, std::move(t)));
-#endif
-        _promise_handle.resume();
+
+    Executor _executor;
+};
+
+template<>
+class task_handler_executor<void> {
+  public:
+    template<typename Token>
+    explicit task_handler_executor(const Token&) {}
+
+  protected:
+    template<typename Initiation>
+    static auto context_executor(const Initiation& init) {
+        return init.get_executor();
+    }
+};
+
+// Allocation, cancellation, deadline and executor handling shared by the handlers.
+template<typename Result, typename Allocator, bool Timed, typename Executor>
+class task_handler_base : public task_handler_executor<Executor> {
+  public:
+    using result_type_t = Result;
+    using promise_type = ::awaitable::promise_handle<result_type_t>;
+    using allocator_type = Allocator;
+    using state_type = typename task_state_for<Result, Timed, Executor>::type;
+    using cancellation_slot_type = asio::cancellation_slot;
+    // operations completing during initiation call the handler inline, the
+    // task_phase handshake then continues the caller without a round-trip
+    // through the io_context and without re-entering it
+    using immediate_executor_type = asio::system_executor;
+
+    template<typename Token>
+    explicit task_handler_base(const Token& token)
+        : task_handler_executor<Executor>(token),
+          _promise_handle(make_state(static_cast<state_type*>(nullptr), token)),
+          _allocator(token.get_allocator()) {
+        init_state(state(), token);
+    }
+    task_handler_base(const task_handler_base&) = delete;
+    task_handler_base& operator=(const task_handler_base&) = delete;
+    task_handler_base(task_handler_base&&) = default;
+    task_handler_base& operator=(task_handler_base&&) = default;
+
+    // asio allocates the operation object through this
+    allocator_type get_allocator() const noexcept { return _allocator; }
+    cancellation_slot_type get_cancellation_slot() const noexcept { return state()->signal.slot(); }
+    immediate_executor_type get_immediate_executor() const noexcept {
+        return immediate_executor_type();
+    }
+
+    // called before the operation is initiated
+    template<typename Initiation>
+    void arm(const Initiation& init) {
+        arm_state(state(), init);
     }
 
-    // private:
     promise_type _promise_handle;
+
+  protected:
+    state_type* state() const noexcept {
+        return static_cast<state_type*>(_promise_handle._state.get());
+    }
+    asio::error_code settle(const asio::error_code& ec) noexcept {
+        return settle_state(state(), ec);
+    }
+    void complete() {
+        if (state()->phase.exchange(task_phase_completed, std::memory_order_acq_rel) ==
+            task_phase_initiating)
+            return;
+        _promise_handle.resume();
+    }
+
+    template<typename State, typename Token>
+    static std::shared_ptr<State> make_state(State*, const Token& token) {
+        return std::allocate_shared<State>(token.get_allocator());
+    }
+    template<typename Token>
+    static std::shared_ptr<task_timed_state<Result>> make_state(
+        task_timed_state<Result>*, const Token& token) {
+        auto state = std::allocate_shared<task_timed_state<Result>>(token.get_allocator());
+        state->self = state;
+        return state;
+    }
+    template<typename Token>
+    static std::shared_ptr<task_bound_timed_state<Result, Executor>> make_state(
+        task_bound_timed_state<Result, Executor>*, const Token& token) {
+        auto state = std::allocate_shared<task_bound_timed_state<Result, Executor>>(
+            token.get_allocator(), token.get_executor());
+        state->self = state;
+        return state;
+    }
+
+    template<typename Token>
+    static void init_state(task_op_state<Result>*, const Token&) {}
+    template<typename A, typename M>
+    static void init_state(task_timed_state<Result>* state, const timed_use_task_t<A, M>& token) {
+        state->timeout = token.timeout();
+    }
+    template<typename Token, typename E>
+    static void init_state(
+        task_timed_state<Result>* state, const bound_use_task_t<Token, E>& token) {
+        init_state(state, token.token());
+    }
+
+    template<typename Initiation>
+    void arm_state(task_op_state<Result>*, const Initiation&) {}
+    template<typename Initiation>
+    void arm_state(task_timed_state<Result>* state, const Initiation& init) {
+        if (state->timeout <= std::chrono::steady_clock::duration::zero())
+            return;
+        state->io_executor = init.get_executor();
+        auto executor = this->context_executor(init);
+        auto& wheel = asio::use_service<::awaitable::deadline_wheel>(
+            asio::query(executor, asio::execution::context));
+        wheel.add(*state, state->timeout, executor);
+    }
+
+    static asio::error_code settle_state(task_op_state<Result>*, const asio::error_code& ec) {
+        return ec;
+    }
+    static asio::error_code settle_state(
+        task_timed_state<Result>* state, const asio::error_code& ec) {
+        state->disarm();
+        // a cancellation posted by the deadline may still be on its way
+        state->signal.slot().clear();
+        if (state->timed_out.load(std::memory_order_acquire) &&
+            ec == asio::error::operation_aborted)
+            return asio::error::timed_out;
+        return ec;
+    }
+
+    Allocator _allocator;
+};
+
+// Completion handler to adapt a promise as a completion handler.
+template<typename T, typename Allocator, typename Mode, bool Timed = false,
+    typename Executor = void>
+class task_promise_handler
+    : public task_handler_base<typename task_result<Mode, T>::type, Allocator, Timed, Executor> {
+  public:
+    using base =
+        task_handler_base<typename task_result<Mode, T>::type, Allocator, Timed, Executor>;
+    using result = task_result<Mode, T>;
+    using base::base;
+
+    void operator()(T t) {
+        this->settle(asio::error_code());
+        this->_promise_handle.set_value(std::move(t));
+        this->complete();
+    }
+    void operator()(const asio::error_code& ec, T t) {
+        result::set(this->_promise_handle, this->settle(ec), std::move(t));
+        this->complete();
+    }
 };
 
 // Completion handler to adapt a void promise as a completion handler.
-template<>
-class promise_handler<void> {
+template<typename Allocator, typename Mode, bool Timed, typename Executor>
+class task_promise_handler<void, Allocator, Mode, Timed, Executor>
+    : public task_handler_base<typename task_result<Mode, void>::type, Allocator, Timed, Executor> {
   public:
-    using result_type_t = asio::error_code;
-    using promise_type = awaitable::promise_handle<result_type_t>;
-
-    // Construct from use_task special value. Used during rebinding.
-    template<typename Allocator>
-    promise_handler(use_task_t<Allocator> /*uf*/) {}
-    promise_handler(const promise_handler&) = delete;
-    promise_handler& operator=(const promise_handler&) = delete;
-    promise_handler(promise_handler&&) = default;
-    promise_handler& operator=(promise_handler&&) = default;
-
-    void operator()() { _promise_handle.resume(); }
+    using base =
+        task_handler_base<typename task_result<Mode, void>::type, Allocator, Timed, Executor>;
+    using result = task_result<Mode, void>;
+    using base::base;
+
+    void operator()() {
+        this->settle(asio::error_code());
+        this->_promise_handle.set_value(typename base::result_type_t());
+        this->complete();
+    }
     void operator()(const asio::error_code& ec) {
-#if defined(ASIO_TASK_EXCEPTION)
-        if (ec) {
-            _promise_handle.set_exception(std::make_exception_ptr(asio::system_error(ec)));
-        } else {
-            _promise_handle.set_value(std::move(ec));
-        }
-#else
-        _promise_handle.set_value(std::move(ec));
-#endif
-        _promise_handle.resume();
+        result::set(this->_promise_handle, this->settle(ec));
+        this->complete();
     }
+};
 
-    // private:
-    promise_type _promise_handle;
+// Maps a completion signature to its task_promise_handler. Signatures without
+// an error_code cannot fail and resolve to the plain value in every mode, this
+// is also how as_tuple(use_task) gets its tuple through.
+template<typename Allocator, typename Mode, bool Timed, typename Executor, typename... Args>
+struct task_promise_handler_for;
+
+template<typename Allocator, typename Mode, bool Timed, typename Executor>
+struct task_promise_handler_for<Allocator, Mode, Timed, Executor> {
+    using type = task_promise_handler<void, Allocator, Mode, Timed, Executor>;
 };
 
-#if defined(ASIO_TASK_EXCEPTION)
-// promise has set_exception will handle exception self.
-#else
-// Ensure any exceptions thrown from the handler are propagated back to the
-// caller via the task.
-template<typename Function, typename T>
-void asio_handler_invoke(Function& f, promise_handler<T>* h) {
-    auto& p(h->_promise_handle);
-    try {
-        f();
-    } catch (...) {
-        p.set_exception(std::current_exception());
-    }
-}
-#endif
-}  // namespace detail
+template<typename Allocator, typename Mode, bool Timed, typename Executor>
+struct task_promise_handler_for<Allocator, Mode, Timed, Executor, asio::error_code> {
+    using type = task_promise_handler<void, Allocator, Mode, Timed, Executor>;
+};
 
-#if !defined(GENERATING_DOCUMENTATION)
+template<typename Allocator, typename Mode, bool Timed, typename Executor, typename Arg>
+struct task_promise_handler_for<Allocator, Mode, Timed, Executor, Arg> {
+    using type = task_promise_handler<Arg, Allocator, task_mode::throws, Timed, Executor>;
+};
 
-// Handler traits specialisation for promise_handler.
-template<typename T>
-class async_result<detail::promise_handler<T>> {
-  public:
-    typedef typename detail::promise_handler<T>::promise_type promise_handle;
-    typedef typename detail::promise_handler<T>::promise_type::await_type type;
+template<typename Allocator, typename Mode, bool Timed, typename Executor, typename Arg>
+struct task_promise_handler_for<Allocator, Mode, Timed, Executor, asio::error_code, Arg> {
+    using type = task_promise_handler<Arg, Allocator, Mode, Timed, Executor>;
+};
 
-    // Constructor creates a new promise for the async operation, and obtains the
-    // corresponding task.
-    explicit async_result(detail::promise_handler<T>& h) : _handle(h._promise_handle) {}
+// Returned by initiating functions. Holds the initiation and its arguments,
+// the operation is only started when the awaiter is suspended on, so an
+// awaitable that is never awaited does no work.
+template<typename Handler, typename Initiation, typename... InitArgs>
+class task_awaiter {
+  public:
+    using await_type = typename Handler::promise_type::await_type;
+
+    template<typename Init, typename Token, typename... Args>
+    task_awaiter(Init&& init, const Token& token, Args&&... args)
+        : _handler(token),
+          _state(_handler._promise_handle.get_awaitable()),
+          _init(std::forward<Init>(init)),
+          _args(std::forward<Args>(args)...) {}
+    task_awaiter(task_awaiter&&) = default;
+    task_awaiter& operator=(task_awaiter&&) = default;
+
+    bool await_ready() { return _state.await_ready(); }
+
+    template<typename P>
+    bool await_suspend(::awaitable::coroutine<P> caller_coro) {
+        _state.await_suspend(caller_coro);
+        auto state = static_cast<typename Handler::state_type*>(_state._state);
+        // the handler may complete and release the state during initiation
+        auto keep = _handler._promise_handle._state;
+        try {
+            _handler.arm(_init);
+            initiate(std::index_sequence_for<InitArgs...>{});
+        } catch (...) {
+            // nothing was started, resume straight away with the exception
+            state->remove_from_list();
+            state->value = std::current_exception();
+            _completed = std::move(keep);
+            return false;
+        }
+        if (state->phase.exchange(task_phase_armed, std::memory_order_acq_rel) ==
+            task_phase_completed) {
+            // completed inline, continue the caller without suspending
+            state->remove_from_list();
+            _completed = std::move(keep);
+            return false;
+        }
+        // the handler owns the caller now, this awaiter may already be resumed
+        return true;
+    }
 
-    // Obtain the task to be returned from the initiating function.
-    type get() { return _handle.get_awaitable(); }
+    auto await_resume() { return _state.await_resume(); }
 
   private:
-    promise_handle _handle;
+    template<size_t... Is>
+    void initiate(std::index_sequence<Is...>) {
+        std::move(_init)(std::move(_handler), std::move(std::get<Is>(_args))...);
+    }
+
+    // moved into the operation when it starts, its promise_handle keeps _state alive
+    Handler _handler;
+    await_type _state;
+    Initiation _init;
+    std::tuple<InitArgs...> _args;
+    // keeps _state alive for await_resume when the handler is already gone
+    std::shared_ptr<typename Handler::promise_type::shared_state> _completed;
 };
 
-// Handler type specialisation for zero arg.
-template<typename Allocator, typename ReturnType>
-struct handler_type<use_task_t<Allocator>, ReturnType()> {
-    typedef detail::promise_handler<void> type;
+// Whether a token carries a deadline and the executor it is bound to.
+template<typename Token>
+struct task_token_traits {
+    static constexpr bool timed = false;
+    using executor_type = void;
 };
 
-// Handler type specialisation for one arg.
-template<typename Allocator, typename ReturnType, typename Arg1>
-struct handler_type<use_task_t<Allocator>, ReturnType(Arg1)> {
-    typedef detail::promise_handler<Arg1> type;
+template<typename Allocator, typename Mode>
+struct task_token_traits<timed_use_task_t<Allocator, Mode>> {
+    static constexpr bool timed = true;
+    using executor_type = void;
 };
 
-// Handler type specialisation for two arg.
-template<typename Allocator, typename ReturnType, typename Arg2>
-struct handler_type<use_task_t<Allocator>, ReturnType(asio::error_code, Arg2)> {
-    typedef detail::promise_handler<Arg2> type;
+template<typename Token, typename Executor>
+struct task_token_traits<bound_use_task_t<Token, Executor>> {
+    static constexpr bool timed = task_token_traits<Token>::timed;
+    using executor_type = Executor;
 };
 
-// Handler type specialisation for special arg asio::error_code.
-#if !defined(ASIO_TASK_VARIANT)
-template<typename Allocator, typename ReturnType>
-struct handler_type<use_task_t<Allocator>, ReturnType(asio::error_code)> {
-    typedef detail::promise_handler<void> type;
+template<typename Token, typename... Args>
+class task_async_result {
+  public:
+    using traits = task_token_traits<Token>;
+    using handler_type = typename task_promise_handler_for<typename Token::allocator_type,
+        typename Token::mode_type, traits::timed, typename traits::executor_type,
+        std::decay_t<Args>...>::type;
+
+    template<typename Initiation, typename... InitArgs>
+    static auto initiate(Initiation&& init, const Token& token, InitArgs&&... args) {
+        using awaiter_type =
+            task_awaiter<handler_type, std::decay_t<Initiation>, std::decay_t<InitArgs>...>;
+        return awaiter_type(std::forward<Initiation>(init), token, std::forward<InitArgs>(args)...);
+    }
 };
-#endif
+}  // namespace detail
+
+#if !defined(GENERATING_DOCUMENTATION)
+
+// Completion token specialisation for use_task, any signature and mode.
+template<typename Allocator, typename Mode, typename R, typename... Args>
+class async_result<use_task_t<Allocator, Mode>, R(Args...)>
+    : public detail::task_async_result<use_task_t<Allocator, Mode>, Args...> {};
+
+// Completion token specialisation for use_task.with_timeout(d).
+template<typename Allocator, typename Mode, typename R, typename... Args>
+class async_result<timed_use_task_t<Allocator, Mode>, R(Args...)>
+    : public detail::task_async_result<timed_use_task_t<Allocator, Mode>, Args...> {};
+
+// Completion token specialisation for use_task.on(executor).
+template<typename Token, typename Executor, typename R, typename... Args>
+class async_result<bound_use_task_t<Token, Executor>, R(Args...)>
+    : public detail::task_async_result<bound_use_task_t<Token, Executor>, Args...> {};
 
 #endif  // !defined(GENERATING_DOCUMENTATION)
 
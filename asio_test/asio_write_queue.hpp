@@ -0,0 +1,339 @@
+//
+// asio_write_queue.hpp
+// ~~~~~~~~~~~~~~
+//
+// One writer for a stream shared by many tasks. co_await queue.write(buffers)
+// queues the caller's buffers without copying them, and send() copies small
+// messages nobody waits for. A flush is posted to run after the current
+// handler, it writes everything queued as one gather write, and whatever is
+// queued while that write is in flight goes out together in the next one.
+// Messages never interleave, and a writer is resumed once all of its bytes
+// were accepted by the stream.
+//
+
+#ifndef ASIO_WRITE_QUEUE_HPP
+#define ASIO_WRITE_QUEUE_HPP
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+#pragma once
+#endif  // defined(_MSC_VER) && (_MSC_VER >= 1200)
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "awaitable_tasks.hpp"
+#include "awaitable_buffers.hpp"
+#include "awaitable_handler_memory.hpp"
+#include "asio/buffer.hpp"
+#include "asio/error.hpp"
+#include "asio/error_code.hpp"
+#include "asio/ip/tcp.hpp"
+#include "asio/post.hpp"
+#include "asio/write.hpp"
+
+namespace awaitable {
+// Callers are resumed on the thread running the stream's io_context, the
+// queue must outlive their writes. A write that is cancelled or reset while
+// still queued is dropped; once its bytes are being written the stream is
+// closed instead, as the rest of them would never follow and the caller's
+// buffers may be gone.
+template<typename Stream = asio::ip::tcp::socket>
+class write_queue {
+  public:
+    // the error and the bytes written, all of them or none
+    using result = std::tuple<asio::error_code, size_t>;
+
+    explicit write_queue(Stream& stream) : _stream(stream) {}
+    ~write_queue() {
+        for (auto w : _waiters)
+            delete w;
+    }
+    write_queue(const write_queue&) = delete;
+    write_queue& operator=(const write_queue&) = delete;
+
+    // auto [ec, n] = co_await queue.write(asio::buffer(head), asio::buffer(body));
+    // the buffers must stay valid until the caller resumes
+    template<typename... ConstBufferSequence>
+    auto write(const ConstBufferSequence&... buffers) {
+        write_awaiter op(*this);
+        int expand[] = {0, (op.add(buffers), 0)...};
+        (void)expand;
+        return op;
+    }
+
+    // copies data to the queue, for messages whose sender does not wait
+    void send(byte_view data) {
+        if (_failed || data.empty())
+            return;
+        _pieces.push_back(piece{nullptr, _owned.size(), data.size()});
+        _owned.append(data.data(), data.size());
+        schedule();
+    }
+
+    // the pending operations keep owner alive, for queues inside shared objects
+    void owned_by(std::weak_ptr<void> owner) { _owner = std::move(owner); }
+
+    // writes issued so far, messages / writes is the coalescing factor
+    size_t writes() const noexcept { return _writes; }
+    // set by the first failed write, later ones fail with it at once
+    const asio::error_code& failed() const noexcept { return _failed; }
+    Stream& stream() noexcept { return _stream; }
+
+  private:
+    enum waiter_state { waiter_idle, waiter_queued, waiter_sending, waiter_done };
+
+    // a span of caller memory, or of _owned when data is null
+    struct piece {
+        const char* data;
+        size_t offset;
+        size_t size;
+    };
+
+    // what a suspended writer links to; owned by the queue so that a reset
+    // caller does not take it along while the write still refers to it
+    struct waiter : promise_base {
+        write_queue* queue;
+        waiter_state state = waiter_idle;
+        uint32_t id = 0;
+        size_t first = 0;
+        size_t last = 0;
+        size_t bytes = 0;
+        asio::error_code ec;
+    };
+
+    struct write_awaiter {
+        write_queue& queue;
+        std::vector<asio::const_buffer> buffers;
+        size_t bytes = 0;
+        waiter* pending = nullptr;
+
+        explicit write_awaiter(write_queue& q) : queue(q) {}
+
+        template<typename ConstBufferSequence>
+        void add(const ConstBufferSequence& sequence) {
+            auto end = asio::buffer_sequence_end(sequence);
+            for (auto it = asio::buffer_sequence_begin(sequence); it != end; ++it) {
+                asio::const_buffer b(*it);
+                if (b.size()) {
+                    buffers.push_back(b);
+                    bytes += b.size();
+                }
+            }
+        }
+
+        bool await_ready() const noexcept { return queue._failed || !bytes; }
+        template<typename P>
+        void await_suspend(coroutine<P> caller_coro) {
+            pending = queue.enqueue(buffers, bytes);
+            caller_coro.promise().insert_before(pending);
+        }
+        result await_resume() {
+            if (!pending)
+                return result(queue._failed, 0);
+            result ret(pending->ec, pending->ec ? 0 : pending->bytes);
+            queue.release(*pending);
+            return ret;
+        }
+    };
+
+    struct flush_handler {
+        using allocator_type = handler_allocator<void>;
+        write_queue* queue;
+        std::shared_ptr<void> keep;
+        allocator_type get_allocator() const noexcept {
+            return allocator_type(queue->_handler_memory);
+        }
+        void operator()() {
+            queue->_scheduled = false;
+            queue->flush();
+        }
+    };
+    struct write_handler {
+        using allocator_type = handler_allocator<void>;
+        write_queue* queue;
+        std::shared_ptr<void> keep;
+        allocator_type get_allocator() const noexcept {
+            return allocator_type(queue->_handler_memory);
+        }
+        void operator()(const asio::error_code& ec, size_t) { queue->on_write(ec); }
+    };
+
+    waiter* enqueue(const std::vector<asio::const_buffer>& buffers, size_t bytes) {
+        waiter* w;
+        if (_idle.empty()) {
+            w = new waiter();
+            w->queue = this;
+            w->_cancel = &cancel_write;
+            _waiters.push_back(w);
+        } else {
+            w = _idle.back();
+            _idle.pop_back();
+        }
+        w->state = waiter_queued;
+        w->id = ++_next_id ? _next_id : ++_next_id;
+        w->first = _pieces.size();
+        for (auto& b : buffers)
+            _pieces.push_back(piece{static_cast<const char*>(b.data()), 0, b.size()});
+        w->last = _pieces.size();
+        w->bytes = bytes;
+        w->ec = asio::error_code();
+        _queued.push_back(w);
+        schedule();
+        return w;
+    }
+    void release(waiter& w) {
+        w.state = waiter_idle;
+        w.id = 0;
+        _idle.push_back(&w);
+    }
+
+    void schedule() {
+        if (!_writing && !_scheduled) {
+            _scheduled = true;
+            asio::post(_stream.get_executor(), flush_handler{this, _owner.lock()});
+        }
+    }
+
+    void flush() {
+        if (_writing || (_pieces.empty() && _queued.empty()))
+            return;
+        // swapped first, a short string keeps its bytes inside the object
+        _inflight.swap(_owned);
+        _owned.clear();
+        _buffers.clear();
+        for (auto& p : _pieces) {
+            if (!p.size)
+                continue;
+            auto data = p.data ? p.data : _inflight.data() + p.offset;
+            // copied messages sit next to each other
+            if (!_buffers.empty() && static_cast<const char*>(_buffers.back().data()) +
+                                             _buffers.back().size() == data) {
+                auto& back = _buffers.back();
+                back = asio::const_buffer(back.data(), back.size() + p.size);
+            } else {
+                _buffers.push_back(asio::const_buffer(data, p.size));
+            }
+        }
+        _pieces.clear();
+        _sending.swap(_queued);
+        for (auto w : _sending)
+            w->state = waiter_sending;
+        if (_buffers.empty()) {
+            _inflight.clear();
+            complete(asio::error_code());
+            return;
+        }
+        _writing = true;
+        ++_writes;
+        asio::async_write(_stream, _buffers, write_handler{this, _owner.lock()});
+    }
+
+    void on_write(const asio::error_code& ec) {
+        _writing = false;
+        _inflight.clear();
+        if (ec) {
+            _failed = ec;
+            asio::error_code ignored;
+            _stream.close(ignored);
+            // what was queued behind the failed write fails with it
+            _pieces.clear();
+            _owned.clear();
+            for (auto w : _queued) {
+                w->state = waiter_sending;
+                _sending.push_back(w);
+            }
+            _queued.clear();
+        }
+        complete(ec);
+        if (!_pieces.empty())
+            flush();
+    }
+
+    // resumes the writers of the finished batch, or frees the waiters of reset ones
+    void complete(const asio::error_code& ec) {
+        std::vector<waiter*> done;
+        done.swap(_sending);
+        for (auto w : done) {
+            w->state = waiter_done;
+            w->ec = ec;
+        }
+        for (auto w : done)
+            resume(*w);
+    }
+    void resume(waiter& w) {
+        if (promise_base::is_resumable(w.prev())) {
+            auto coro = w.prev()->_coro;
+            w.remove_from_list();
+            coro.resume();
+        } else {
+            w.remove_from_list();
+            release(w);
+        }
+    }
+
+    void drop(waiter& w) {
+        for (size_t i = w.first; i < w.last; ++i)
+            _pieces[i].size = 0;
+        for (size_t i = 0; i < _queued.size(); ++i) {
+            if (_queued[i] == &w) {
+                _queued.erase(_queued.begin() + i);
+                break;
+            }
+        }
+    }
+
+    // task.cancel() resumes the writer with operation_aborted, later from the
+    // io_context so cancel() does not run the caller inline; task.reset() has
+    // already unlinked it
+    static void cancel_write(promise_base* base) {
+        auto w = static_cast<waiter*>(base);
+        auto queue = w->queue;
+        switch (w->state) {
+        case waiter_queued: {
+            queue->drop(*w);
+            w->state = waiter_done;
+            w->ec = asio::error::operation_aborted;
+            if (!w->prev()) {
+                queue->release(*w);
+                return;
+            }
+            auto id = w->id;
+            asio::post(queue->_stream.get_executor(), [w, id] {
+                if (w->id == id)
+                    w->queue->resume(*w);
+            });
+            return;
+        }
+        case waiter_sending: {
+            asio::error_code ignored;
+            queue->_stream.close(ignored);
+            return;
+        }
+        default: return;
+        }
+    }
+
+    Stream& _stream;
+    // queued for the next write
+    std::vector<piece> _pieces;
+    std::string _owned;
+    std::vector<waiter*> _queued;
+    // the write in flight
+    std::vector<asio::const_buffer> _buffers;
+    std::string _inflight;
+    std::vector<waiter*> _sending;
+    std::vector<waiter*> _waiters;
+    std::vector<waiter*> _idle;
+    uint32_t _next_id = 0;
+    bool _writing = false;
+    bool _scheduled = false;
+    size_t _writes = 0;
+    asio::error_code _failed;
+    std::weak_ptr<void> _owner;
+    handler_memory _handler_memory;
+};
+}  // namespace awaitable
+
+#endif  // ASIO_WRITE_QUEUE_HPP
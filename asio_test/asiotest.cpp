@@ -7,14 +7,29 @@
 #include <ostream>
 #include <string>
 #include <functional>
+#include <thread>
 #include "asio.hpp"
 #include "asio_use_task.hpp"
+#include "asio_socket_reader.hpp"
+#include "asio_socket_chunks.hpp"
+#include "asio_http_client.hpp"
+#include "asio_rpc.hpp"
+#include "asio_write_queue.hpp"
+#include "asio_connection_pool.hpp"
+#include "asio_runtime.hpp"
+#include "awaitable_handler_memory.hpp"
+#if defined(__linux__)
+#include <cstdio>
+#include "asio_append_log.hpp"
+#include "asio_udp_batch.hpp"
+#include "asio_sendfile.hpp"
+#endif
 using asio::ip::tcp;
 
 class client {
   public:
-    client(asio::io_service& io_service, const std::string& server, const std::string& path)
-        : resolver_(io_service), socket_(io_service) {
+    client(asio::io_context& io_context, const std::string& server, const std::string& path)
+        : resolver_(io_context), socket_(io_context) {
         // Form the request. We specify the "Connection: close" header so that the
         // server will close the socket after transmitting the response. This will
         // allow us to treat all data up until the EOF as the content.
@@ -26,8 +41,7 @@ class client {
 
         // Start an asynchronous resolve to translate the server and service names
         // into a list of endpoints.
-        tcp::resolver::query query(server, "http");
-        resolver_.async_resolve(query,
+        resolver_.async_resolve(server, "http",
                     std::bind(&client::handle_resolve,
                             this,
                             std::placeholders::_1,
@@ -35,12 +49,12 @@ class client {
     }
 
   private:
-    void handle_resolve(const asio::error_code& err, tcp::resolver::iterator endpoint_iterator) {
+    void handle_resolve(const asio::error_code& err, const tcp::resolver::results_type& endpoints) {
         if (!err) {
             // Attempt a connection to each endpoint in the list until we
             // successfully establish a connection.
             asio::async_connect(socket_,
-                    endpoint_iterator,
+                    endpoints,
                     std::bind(&client::handle_connect, this, std::placeholders::_1));
         } else {
             std::cout << "Error: " << err.message() << "\n";
@@ -146,15 +160,14 @@ class client {
     asio::streambuf response_;
 };
 
-int sync_request(asio::io_service& io_service, const std::string& server, const std::string& path) {
+int sync_request(asio::io_context& io_context, const std::string& server, const std::string& path) {
     try {
         // Get a list of endpoints corresponding to the server name.
-        tcp::resolver resolver(io_service);
-        tcp::resolver::query query(server, "http");
-        auto endpoints = resolver.resolve(query);
+        tcp::resolver resolver(io_context);
+        auto endpoints = resolver.resolve(server, "http");
 
         // Try each endpoint until we successfully establish a connection.
-        tcp::socket socket(io_service);
+        tcp::socket socket(io_context);
         asio::connect(socket, endpoints);
 
         // Form the request. We specify the "Connection: close" header so that the
@@ -219,8 +232,8 @@ int sync_request(asio::io_service& io_service, const std::string& server, const
     return 0;
 }
 
-#if defined(ASIO_TASK_EXCEPTION)
-awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service,
+// errors thrown as asio::system_error
+awaitable::task<asio::error_code> make_request_task(asio::io_context& io_context,
                                     const std::string& server,
                                     const std::string& path) {
     asio::error_code err;
@@ -234,12 +247,10 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
         request_stream << "Accept: */*\r\n";
         request_stream << "Connection: close\r\n\r\n";
 
-        tcp::resolver::query query(server, "http");
-
-        tcp::socket socket_(io_service);
-        tcp::resolver resolver_(io_service);
+        tcp::socket socket_(io_context);
+        tcp::resolver resolver_(io_context);
 
-        auto resolver_ret = co_await resolver_.async_resolve(query, asio::use_task);
+        auto resolver_ret = co_await resolver_.async_resolve(server, "http", asio::use_task);
 
         // Attempt a connection to each endpoint in the list until we
         // successfully establish a connection.
@@ -247,57 +258,40 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
 
         co_await asio::async_write(socket_, request_, asio::use_task);
 
-        asio::streambuf response_;
-        co_await asio::async_read_until(socket_, response_, "\r\n", asio::use_task);
+        // Responses are parsed in place in the reader's buffer.
+        awaitable::socket_reader<tcp::socket> reader(socket_);
+        auto [head_err, head_data] = co_await reader.read_until("\r\n\r\n");
+        if (head_err)
+            throw asio::system_error(head_err);
 
         // Check that response is OK.
-        std::istream response_stream(&response_);
-        std::string http_version;
-        response_stream >> http_version;
-        unsigned int status_code;
-        response_stream >> status_code;
-        std::string status_message;
-        std::getline(response_stream, status_message);
-        if (!response_stream || http_version.substr(0, 5) != "HTTP/") {
+        awaitable::http_response_head head;
+        if (!awaitable::parse_http_response_head(head_data, head)) {
             std::cout << "Invalid response\n";
             return asio::error_code();
         }
-        if (status_code != 200) {
+        if (head.status != 200) {
             std::cout << "Response returned with status code ";
-            std::cout << status_code << "\n";
+            std::cout << head.status << "\n";
             return asio::error_code();
         }
 
-        // Read the response headers, which are terminated by a blank line.
-        co_await asio::async_read_until(socket_, response_, "\r\n\r\n", asio::use_task);
-
         // Process the response headers.
-        std::istream response_stream2(&response_);
-        std::string header;
-        while (std::getline(response_stream2, header) && header != "\r")
-            std::cout << header << "\n";
+        for (size_t i = 0; i < head.header_count; ++i) {
+            auto& header = head.headers[i];
+            std::cout.write(header.name.data(), header.name.size()) << ": ";
+            std::cout.write(header.value.data(), header.value.size()) << "\n";
+        }
         std::cout << "\n";
 
-        // Write whatever content we already have to output.
-        if (response_.size() > 0)
-            std::cout << &response_;
-
-        // Continue reading remaining data until EOF.
-        // Read until EOF, writing data to output as we go.
-        try {
-            for (;;) {
-                auto count = co_await asio::async_read(socket_,
-                                                response_,
-                                                asio::transfer_at_least(1),
-                                                asio::use_task);
-                if (count)
-                    std::cout << &response_;
-            }
-        } catch (std::system_error& e) {
-            if (e.code() == asio::error::eof) {
+        // Write the content to output as it arrives, until EOF.
+        for (;;) {
+            auto [body_err, body] = co_await reader.read_some();
+            if (body_err == asio::error::eof)
                 return asio::error_code();
-            }
-            throw asio::system_error(e.code());
+            if (body_err)
+                throw asio::system_error(body_err);
+            std::cout.write(body.data(), body.size());
         }
     } catch (std::exception& e) {
         std::cout << "Exception: " << e.what() << "\n";
@@ -306,8 +300,9 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
     return asio::error_code();
 }
 
-#elif defined(ASIO_TASK_VARIANT)
-awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service,
+
+// errors returned in a variant, nothing thrown
+awaitable::task<asio::error_code> make_request_task_ec(asio::io_context& io_context,
                                     const std::string& server,
                                     const std::string& path) {
     asio::error_code err;
@@ -320,29 +315,30 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
     request_stream << "Host: " << server << "\r\n";
     request_stream << "Accept: */*\r\n";
     request_stream << "Connection: close\r\n\r\n";
-    tcp::resolver::query query(server, "http");
-    tcp::resolver resolver_(io_service);
-    tcp::socket socket_(io_service);
+    tcp::resolver resolver_(io_context);
+    tcp::socket socket_(io_context);
 
-    auto resolver_ret = co_await resolver_.async_resolve(query, asio::use_task);
+    auto resolver_ret = co_await resolver_.async_resolve(server, "http", asio::use_task_ec);
 
     if (NS_VARIANT::get_if<asio::error_code>(&resolver_ret))
         return NS_VARIANT::get<asio::error_code>(resolver_ret);
 
-    auto iter = NS_VARIANT::get<asio::ip::tcp::resolver::iterator>(resolver_ret);
+    auto endpoints = NS_VARIANT::get<tcp::resolver::results_type>(resolver_ret);
 
     // Attempt a connection to each endpoint in the list until we
     // successfully establish a connection.
-    auto&& connect_ret = co_await asio::async_connect(socket_, iter, asio::use_task);
+    auto&& connect_ret = co_await asio::async_connect(
+        socket_, endpoints, asio::use_task_ec.with_timeout(std::chrono::seconds(10)));
     if (NS_VARIANT::get_if<asio::error_code>(&connect_ret))
         return NS_VARIANT::get<asio::error_code>(connect_ret);
 
-    auto&& write_ret = co_await asio::async_write(socket_, request_, asio::use_task);
+    auto&& write_ret = co_await asio::async_write(socket_, request_, asio::use_task_ec);
     if (NS_VARIANT::get_if<asio::error_code>(&write_ret))
         return NS_VARIANT::get<asio::error_code>(write_ret);
 
     asio::streambuf response_;
-    auto&& read_ret = co_await asio::async_read_until(socket_, response_, "\r\n", asio::use_task);
+    auto&& read_ret =
+        co_await asio::async_read_until(socket_, response_, "\r\n", asio::use_task_ec);
     if (NS_VARIANT::get_if<asio::error_code>(&read_ret))
         return NS_VARIANT::get<asio::error_code>(read_ret);
 
@@ -366,7 +362,7 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
 
     // Read the response headers, which are terminated by a blank line.
     auto&& read_ret2 =
-        co_await asio::async_read_until(socket_, response_, "\r\n\r\n", asio::use_task);
+        co_await asio::async_read_until(socket_, response_, "\r\n\r\n", asio::use_task_ec);
     if (NS_VARIANT::get_if<asio::error_code>(&read_ret2))
         return NS_VARIANT::get<asio::error_code>(read_ret2);
 
@@ -381,25 +377,25 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
     if (response_.size() > 0)
         std::cout << &response_;
 
-    // Continue reading remaining data until EOF.
+    // Continue reading remaining data until EOF, in pooled chunks with the
+    // next read already running while one is written out.
+    awaitable::socket_chunks<tcp::socket> chunks(socket_);
     for (;;) {
-        auto&& rett = co_await asio::async_read(socket_,
-                                        response_,
-                                        asio::transfer_at_least(1),
-                                        asio::use_task);
-        if (NS_VARIANT::get_if<asio::error_code>(&rett)) {
-            err = NS_VARIANT::get<asio::error_code>(rett);
+        auto [chunk_err, chunk] = co_await chunks.next();
+        if (chunk_err) {
+            err = chunk_err;
             if (err == asio::error::eof) {
                 err = asio::error_code();
             }
             break;
         }
-        std::cout << &response_;
+        std::cout.write(chunk.data(), chunk.size());
     }
     return err;
 }
-#else
-awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service,
+
+// errors returned in a tuple next to the value
+awaitable::task<asio::error_code> make_request_task_tuple(asio::io_context& io_context,
                                     const std::string& server,
                                     const std::string& path) {
     asio::error_code err;
@@ -411,31 +407,31 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
     request_stream << "Host: " << server << "\r\n";
     request_stream << "Accept: */*\r\n";
     request_stream << "Connection: close\r\n\r\n";
-    tcp::resolver::query query(server, "http");
-    tcp::resolver resolver_(io_service);
-    tcp::socket socket_(io_service);
+    const auto token = asio::as_tuple(asio::use_task);
+    tcp::resolver resolver_(io_context);
+    tcp::socket socket_(io_context);
 
-    auto resolver_ret = co_await resolver_.async_resolve(query, asio::use_task);
+    auto resolver_ret = co_await resolver_.async_resolve(server, "http", token);
 
     err = std::get<0>(resolver_ret);
     if (err)
         return err;
-    asio::ip::tcp::resolver::iterator iter = std::get<1>(resolver_ret);
+    auto endpoints = std::get<1>(resolver_ret);
 
     // Attempt a connection to each endpoint in the list until we
     // successfully establish a connection.
-    auto&& connect_ret = co_await asio::async_connect(socket_, iter, asio::use_task);
+    auto&& connect_ret = co_await asio::async_connect(socket_, endpoints, token);
     err = std::get<0>(connect_ret);
     if (err)
         return err;
 
-    auto&& write_ret = co_await asio::async_write(socket_, request_, asio::use_task);
+    auto&& write_ret = co_await asio::async_write(socket_, request_, token);
     err = std::get<0>(write_ret);
     if (err)
         return err;
 
     asio::streambuf response_;
-    auto&& read_ret = co_await asio::async_read_until(socket_, response_, "\r\n", asio::use_task);
+    auto&& read_ret = co_await asio::async_read_until(socket_, response_, "\r\n", token);
     err = std::get<0>(read_ret);
     if (err)
         return err;
@@ -460,7 +456,7 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
 
     // Read the response headers, which are terminated by a blank line.
     auto&& read_ret2 =
-        co_await asio::async_read_until(socket_, response_, "\r\n\r\n", asio::use_task);
+        co_await asio::async_read_until(socket_, response_, "\r\n\r\n", token);
     err = std::get<0>(read_ret2);
     if (err)
         return err;
@@ -481,7 +477,7 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
         auto&& rett = co_await asio::async_read(socket_,
                                         response_,
                                         asio::transfer_at_least(1),
-                                        asio::use_task);
+                                        token);
         err = std::get<0>(rett);
         if (!err) {
             std::cout << &response_;
@@ -494,7 +490,200 @@ awaitable::task<asio::error_code> make_request_task(asio::io_service& io_service
     }
     return err;
 }
+// resetting the task cancels the wait, the timer does not keep io_context busy
+awaitable::task<asio::error_code> wait_forever(asio::steady_timer& timer) {
+    timer.expires_after(std::chrono::hours(1));
+    return co_await timer.async_wait(asio::use_task_ec);
+}
+
+// reset while the read is pending: the operation completes after the frame
+// and its handler_memory are gone, the buffer is the caller's
+awaitable::task<size_t> read_pending(tcp::socket& socket, std::string& data) {
+    awaitable::handler_memory memory;
+    auto token = asio::use_task[awaitable::handler_allocator<void>(memory)];
+    auto n = co_await socket.async_read_some(asio::buffer(&data[0], data.size()), token);
+    return n;
+}
+
+// the deadline cancels the wait and reports timed_out
+awaitable::task<asio::error_code> wait_with_deadline(asio::steady_timer& timer) {
+    timer.expires_after(std::chrono::hours(1));
+    auto ec = co_await timer.async_wait(
+        asio::use_task_ec.with_timeout(std::chrono::milliseconds(50)));
+    std::cout << "timer wait: " << ec.message() << "\n";
+    return ec;
+}
+
+// every resume runs on the strand, whichever thread completed the wait
+awaitable::task<int> strand_ticks(asio::strand<asio::io_context::executor_type> strand,
+                                  asio::steady_timer& timer) {
+    int ticks = 0;
+    for (; ticks < 3; ++ticks) {
+        timer.expires_after(std::chrono::milliseconds(10));
+        co_await timer.async_wait(asio::use_task.on(strand));
+        AWAITTASK_ASSERT(strand.running_in_this_thread());
+    }
+    return ticks;
+}
+
+// keep-alive server for the client demo, /chunked is answered chunked
+awaitable::task<int> serve_loopback(tcp::socket socket) {
+    awaitable::socket_reader<tcp::socket> reader(socket);
+    for (int served = 0;; ++served) {
+        auto [ec, head] = co_await reader.read_until("\r\n\r\n");
+        if (ec)
+            return served;
+        std::string reply = head.starts_with("GET /chunked ")
+                                ? "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                  "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"
+                                : "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world";
+        auto written = co_await asio::async_write(socket, asio::buffer(reply), asio::use_task_ec);
+        if (NS_VARIANT::get_if<asio::error_code>(&written))
+            return served;
+    }
+}
+
+awaitable::task<int> accept_loopback(tcp::acceptor& acceptor) {
+    for (int accepted = 0;; ++accepted) {
+        auto ret = co_await acceptor.async_accept(asio::use_task_ec);
+        if (NS_VARIANT::get_if<asio::error_code>(&ret))
+            return accepted;
+        serve_loopback(std::move(NS_VARIANT::get<tcp::socket>(ret)));
+    }
+}
+
+// sequential requests share one pooled connection, then a pipelined batch
+// and a body streamed to a callback
+awaitable::task<int> fetch_loopback(awaitable::http_client& client, std::string port,
+                                    tcp::acceptor& acceptor) {
+    awaitable::http_request req;
+    for (auto target : {"/", "/chunked", "/"}) {
+        req.target = target;
+        auto [ec, resp] = co_await client.request("127.0.0.1", port, req);
+        std::cout << target << ": " << resp.status << " " << resp.body << " " << ec.message()
+                  << "\n";
+    }
+    std::vector<awaitable::http_request> batch(3);
+    batch[1].target = "/chunked";
+    auto [batch_ec, responses] = co_await client.pipeline("127.0.0.1", port, batch);
+    std::cout << "pipelined " << responses.size() << ": " << batch_ec.message() << "\n";
+    size_t streamed = 0;
+    req.target = "/chunked";
+    co_await client.request(
+        "127.0.0.1", port, req, [&](awaitable::byte_view piece) { streamed += piece.size(); });
+    std::cout << "streamed " << streamed << " bytes, connections " << client.connects() << "\n";
+    client.close_idle();
+    acceptor.close();
+    return 0;
+}
+
+// three calls share one rpc connection; the server answers them out of order
+awaitable::task<int> accept_rpc(tcp::acceptor& acceptor, awaitable::rpc_server& server) {
+    auto ret = co_await acceptor.async_accept(asio::use_task_ec);
+    if (NS_VARIANT::get_if<asio::error_code>(&ret))
+        return 0;
+    server.serve(std::move(NS_VARIANT::get<tcp::socket>(ret)));
+    return 1;
+}
+
+awaitable::task<int> call_rpc(awaitable::rpc_client<tcp::socket>& client, uint32_t method,
+                              std::string payload) {
+    auto [ec, resp] = co_await client.call(method, payload);
+    std::cout << "rpc " << method << ": " << resp.status << " " << resp.payload << " "
+              << ec.message() << "\n";
+    return ec ? 0 : 1;
+}
+
+// many tasks write whole lines to one socket, gathered into few writes
+awaitable::task<int> queue_line(awaitable::write_queue<tcp::socket>& queue, int i) {
+    std::string line = "line " + std::to_string(i) + "\n";
+    auto [ec, n] = co_await queue.write(asio::buffer(line));
+    return ec ? 0 : static_cast<int>(n);
+}
+
+// four users share two pooled connections, two of them wait for a lease
+awaitable::task<int> use_pooled(awaitable::connection_pool<awaitable::tcp_connect>& pool,
+                                tcp::endpoint endpoint) {
+    auto [ec, conn] = co_await pool.get(endpoint);
+    if (ec)
+        return 0;
+    asio::steady_timer busy(conn->get_executor(), std::chrono::milliseconds(10));
+    co_await busy.async_wait(asio::use_task_ec);
+    return 1;
+}
+
+// a connection runs on the loop it was placed on, and hops to loop 0 and back
+awaitable::task<int> echo_sharded(awaitable::io_runtime& runtime, tcp::socket socket) {
+    int home = runtime.current();
+    co_await runtime.resume_on(0);
+    co_await runtime.resume_on(static_cast<size_t>(home));
+    char data[16];
+    auto ret = co_await socket.async_read_some(asio::buffer(data), asio::use_task_ec);
+    if (NS_VARIANT::get_if<asio::error_code>(&ret))
+        return 0;
+    co_await asio::async_write(socket, asio::buffer(data, NS_VARIANT::get<1>(ret)),
+                               asio::use_task_ec);
+    return home;
+}
+
+#if defined(__linux__)
+// appends made by one handler go to the file as one batch
+awaitable::task<int> append_line(awaitable::append_log& log, int i, int& durable,
+                                 asio::executor_work_guard<asio::io_context::executor_type>& work) {
+    std::string line = "record " + std::to_string(i) + "\n";
+    auto ec = co_await log.append(line);
+    if (!ec)
+        ++durable;
+    if (durable == 100)
+        work.reset();
+    return ec ? 0 : 1;
+}
+
+// 32 datagrams go out in one send_batch and come back in order on loopback
+awaitable::task<int> udp_round_trip(asio::ip::udp::socket& sender,
+                                    asio::ip::udp::socket& receiver) {
+    awaitable::udp_batch_socket tx(sender), rx(receiver);
+    std::vector<std::string> payloads;
+    std::vector<awaitable::datagram> out;
+    for (int i = 0; i < 32; ++i)
+        payloads.push_back("datagram " + std::to_string(i));
+    for (auto& p : payloads)
+        out.push_back(awaitable::datagram{p.data(), p.size(), receiver.local_endpoint(), {}});
+    auto [ec, sent] = co_await tx.send_batch(out);
+    size_t received = 0, matched = 0;
+    while (!ec && received < sent) {
+        auto [err, batch] = co_await rx.receive_batch();
+        if (err)
+            break;
+        for (auto& d : batch) {
+            if (received < payloads.size() && std::string(d.data, d.size) == payloads[received])
+                ++matched;
+            ++received;
+        }
+    }
+    std::cout << "udp batch: " << sent << " sent, " << matched << " of " << received
+              << " received in order\n";
+    return static_cast<int>(matched);
+}
+
+awaitable::task<awaitable::transfer_result> send_whole_file(tcp::socket& socket, int fd,
+                                                            size_t size) {
+    auto ret = co_await awaitable::send_file(socket, fd, 0, size);
+    return ret;
+}
+
+// a file goes out with send_file while the peer splices the socket into another file
+awaitable::task<int> transfer_file(tcp::socket& sender, tcp::socket& receiver, int src, int dst,
+                                   size_t size) {
+    auto sending = send_whole_file(sender, src, size);
+    auto [splice_ec, spliced] = co_await awaitable::splice(receiver, dst, size);
+    auto [send_ec, sent] = co_await sending;
+    std::cout << "send_file: " << sent << " bytes " << send_ec.message() << ", splice: "
+              << spliced << " bytes " << splice_ec.message() << "\n";
+    return !send_ec && !splice_ec;
+}
 #endif
+
 namespace awaitable {
 namespace detail {
 template<typename F, typename R>
@@ -541,20 +730,207 @@ int main(int argc, char* argv[]) {
         }
         //         {
         //             std::cout << "sync_request\n";
-        //             asio::io_service io_service;
-        //             sync_request(io_service, server, path);
+        //             asio::io_context io_context;
+        //             sync_request(io_context, server, path);
         //         }
         //         {
         //             std::cout << "async_request\n";
-        //             asio::io_service io_service;
-        //             client c(io_service, server, path);
-        //             io_service.run();
+        //             asio::io_context io_context;
+        //             client c(io_context, server, path);
+        //             io_context.run();
         //         }
         {
-            asio::io_service io_service;
-            make_request_task(io_service, server, path);
-            io_service.run();
+            asio::io_context io_context;
+            make_request_task(io_context, server, path);
+            io_context.run();
+        }
+        {
+            asio::io_context io_context;
+            asio::steady_timer timer(io_context);
+            auto waiting = wait_forever(timer);
+            waiting.reset();
+            io_context.run();
+            std::cout << "timer wait cancelled\n";
+        }
+        {
+            asio::io_context io_context;
+            tcp::acceptor acceptor(io_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            tcp::socket socket(io_context), peer(io_context);
+            socket.connect(acceptor.local_endpoint());
+            acceptor.accept(peer);
+            std::string data(64, '\0');
+            auto reading = read_pending(socket, data);
+            reading.reset();
+            asio::write(peer, asio::buffer("late", 4));
+            // the read completes, aborted or with the late bytes, into no frame
+            io_context.run();
+            std::cout << "read reset\n";
         }
+        {
+            asio::io_context io_context;
+            asio::steady_timer timer(io_context);
+            auto waiting = wait_with_deadline(timer);
+            io_context.run();
+        }
+        {
+            asio::io_context io_context;
+            auto strand = asio::make_strand(io_context);
+            asio::steady_timer timer(strand);
+            awaitable::task<int> ticking;
+            asio::dispatch(strand, [&] { ticking = strand_ticks(strand, timer); });
+            std::thread other([&] { io_context.run(); });
+            io_context.run();
+            other.join();
+            std::cout << "strand ticks done\n";
+        }
+        {
+            asio::io_context io_context;
+            tcp::acceptor acceptor(io_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            awaitable::http_client client(io_context);
+            auto accepting = accept_loopback(acceptor);
+            auto fetching = fetch_loopback(
+                client, std::to_string(acceptor.local_endpoint().port()), acceptor);
+            io_context.run();
+        }
+        {
+            asio::io_context io_context;
+            tcp::acceptor acceptor(io_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            asio::steady_timer delay(io_context);
+            awaitable::rpc_server server(
+                [&](uint32_t method, awaitable::byte_view payload)
+                    -> awaitable::task<awaitable::rpc_response> {
+                    awaitable::rpc_response resp;
+                    resp.payload = payload.to_string();
+                    if (method == 1) {
+                        // answered after the calls behind it
+                        delay.expires_after(std::chrono::milliseconds(10));
+                        co_await delay.async_wait(asio::use_task_ec);
+                    }
+                    return resp;
+                });
+            auto accepting = accept_rpc(acceptor, server);
+            tcp::socket socket(io_context);
+            socket.connect(acceptor.local_endpoint());
+            awaitable::rpc_client<tcp::socket> client(std::move(socket));
+            auto first = call_rpc(client, 1, "slow");
+            auto second = call_rpc(client, 2, "fast");
+            auto third = call_rpc(client, 3, "faster");
+            asio::steady_timer done(io_context, std::chrono::milliseconds(50));
+            done.async_wait([&](const asio::error_code&) { client.close(); });
+            io_context.run();
+        }
+        {
+            asio::io_context io_context;
+            tcp::acceptor acceptor(io_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            tcp::socket socket(io_context), peer(io_context);
+            socket.connect(acceptor.local_endpoint());
+            acceptor.accept(peer);
+            awaitable::write_queue<tcp::socket> queue(socket);
+            std::vector<awaitable::task<int>> writers;
+            for (int i = 0; i < 100; ++i)
+                writers.push_back(queue_line(queue, i));
+            io_context.run();
+            std::cout << "100 lines in " << queue.writes() << " writes\n";
+        }
+        {
+            asio::io_context io_context;
+            tcp::acceptor acceptor(io_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            auto accepting = accept_loopback(acceptor);
+            awaitable::connection_pool_options opts;
+            opts.max_per_endpoint = 2;
+            awaitable::connection_pool<awaitable::tcp_connect> pool(io_context, opts, io_context);
+            pool.warm(acceptor.local_endpoint(), 1);
+            std::vector<awaitable::task<int>> users;
+            for (int i = 0; i < 4; ++i)
+                users.push_back(use_pooled(pool, acceptor.local_endpoint()));
+            asio::steady_timer done(io_context, std::chrono::milliseconds(50));
+            done.async_wait([&](const asio::error_code&) {
+                std::cout << "pool: " << pool.connects() << " connects, " << pool.waits()
+                          << " waits, max wait " << pool.wait_time().max() / 1000 << " us\n";
+                pool.close_idle();
+                acceptor.close();
+            });
+            io_context.run();
+        }
+        {
+            awaitable::io_runtime_options opts;
+            opts.threads = 2;
+            awaitable::io_runtime runtime(opts);
+            tcp::acceptor acceptor(runtime.context(0),
+                                   tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            runtime.start();
+            asio::post(runtime.context(0), [&] {
+                runtime.serve(acceptor, [&](tcp::socket socket) {
+                    return echo_sharded(runtime, std::move(socket));
+                });
+            });
+            asio::io_context io_context;
+            for (int i = 0; i < 4; ++i) {
+                tcp::socket client(io_context);
+                client.connect(acceptor.local_endpoint());
+                char data[4];
+                asio::write(client, asio::buffer("ping", 4));
+                asio::read(client, asio::buffer(data));
+            }
+            asio::post(runtime.context(0), [&] { acceptor.close(); });
+            runtime.stop();
+            runtime.join();
+            for (size_t i = 0; i < runtime.size(); ++i) {
+                auto stats = runtime.stats(i);
+                std::cout << "loop " << i << ": " << stats.handlers << " handlers, utilization "
+                          << stats.utilization() << "\n";
+            }
+        }
+#if defined(__linux__)
+        {
+            asio::io_context io_context;
+            // the writes complete on the pool, nothing keeps run() going meanwhile
+            auto work = asio::make_work_guard(io_context);
+            awaitable::blocking_pool pool(1);
+            const char* path = "append_log_demo.log";
+            std::remove(path);
+            awaitable::append_log log(io_context, pool, path);
+            int durable = 0;
+            std::vector<awaitable::task<int>> appends;
+            for (int i = 0; i < 100; ++i)
+                appends.push_back(append_line(log, i, durable, work));
+            io_context.run();
+            struct stat st;
+            bool on_disk = ::stat(path, &st) == 0 && uint64_t(st.st_size) == log.size();
+            std::cout << "append_log: " << durable << " durable, " << log.size() << " bytes"
+                      << (on_disk ? "" : ", size differs from the file") << "\n";
+        }
+        {
+            asio::io_context io_context;
+            asio::ip::udp::endpoint loopback(asio::ip::address_v4::loopback(), 0);
+            asio::ip::udp::socket sender(io_context, loopback), receiver(io_context, loopback);
+            auto trip = udp_round_trip(sender, receiver);
+            io_context.run();
+        }
+        {
+            asio::io_context io_context;
+            tcp::acceptor acceptor(io_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+            tcp::socket sender(io_context), receiver(io_context);
+            sender.connect(acceptor.local_endpoint());
+            acceptor.accept(receiver);
+            std::string content;
+            for (int i = 0; content.size() < (1 << 20); ++i)
+                content += "line " + std::to_string(i) + "\n";
+            int src = ::open("send_file_demo.in", O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            int dst = ::open("send_file_demo.out", O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (src >= 0 && dst >= 0 &&
+                ::write(src, content.data(), content.size()) == ssize_t(content.size())) {
+                auto transfer = transfer_file(sender, receiver, src, dst, content.size());
+                io_context.run();
+                std::string copy(content.size(), '\0');
+                bool same = ::pread(dst, &copy[0], copy.size(), 0) == ssize_t(copy.size()) &&
+                            copy == content;
+                std::cout << "send_file: the spliced copy " << (same ? "matches" : "differs") << "\n";
+            }
+            ::close(src);
+            ::close(dst);
+        }
+#endif
     } catch (std::exception& e) {
         std::cout << "Exception: " << e.what() << "\n";
     }
@@ -0,0 +1,31 @@
+// bench.cpp : Defines the entry point for the benchmark programs.
+//
+
+#include <cstring>
+#include "bench.h"
+
+static int usage() {
+    std::printf("Usage: bench <name> [args...]\n");
+    std::printf("  walk [dir] [depth] [fanout] [files]   parallel directory walk, Linux only\n");
+    std::printf("  http [iterations] [headers]           http head parsing and crlf scanning\n");
+    std::printf("  server [threads] [conns] [secs] [depth] http_server requests/sec and latency\n");
+    std::printf("  rpc [conns] [in_flight] [secs] [payload]  rpc calls/sec and frames per write\n");
+    std::printf("  load [http|rpc] [rate] [conns] [secs] open-loop latency at a fixed rate\n");
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2)
+        return usage();
+    if (std::strcmp(argv[1], "walk") == 0)
+        return walk_bench(argc - 1, argv + 1);
+    if (std::strcmp(argv[1], "http") == 0)
+        return http_bench(argc - 1, argv + 1);
+    if (std::strcmp(argv[1], "server") == 0)
+        return server_bench(argc - 1, argv + 1);
+    if (std::strcmp(argv[1], "rpc") == 0)
+        return rpc_bench(argc - 1, argv + 1);
+    if (std::strcmp(argv[1], "load") == 0)
+        return load_bench(argc - 1, argv + 1);
+    return usage();
+}
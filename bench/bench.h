@@ -0,0 +1,22 @@
+// bench.h : shared helpers for the benchmark programs
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+// each benchmark takes the arguments following its name on the command line
+int walk_bench(int argc, char* argv[]);
+int http_bench(int argc, char* argv[]);
+int server_bench(int argc, char* argv[]);
+int rpc_bench(int argc, char* argv[]);
+int load_bench(int argc, char* argv[]);
+
+template<typename F>
+double time_seconds(F&& func) {
+    auto start = std::chrono::steady_clock::now();
+    std::forward<F>(func)();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
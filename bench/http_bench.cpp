@@ -0,0 +1,97 @@
+// http_bench.cpp : parse_http_response_head against the istream/getline
+// parsing make_request_task used, and the vectorized CRLFCRLF scanner against
+// the memchr search byte_view::find does.
+//
+
+#include <cstdlib>
+#include <istream>
+#include <string>
+#include "bench.h"
+#include "asio.hpp"
+#include "awaitable_http.hpp"
+
+namespace {
+std::string make_response(int headers) {
+    std::string r = "HTTP/1.1 200 OK\r\n";
+    for (int i = 0; i < headers; ++i)
+        r += "X-Header-" + std::to_string(i) + ": some header value " + std::to_string(i) + "\r\n";
+    r += "Content-Length: 5\r\n\r\nhello";
+    return r;
+}
+
+// what make_request_task did with the streambuf filled by async_read_until
+size_t istream_parse(const std::string& response) {
+    asio::streambuf buf;
+    std::ostream(&buf) << response;
+    std::istream response_stream(&buf);
+    std::string http_version;
+    response_stream >> http_version;
+    unsigned int status_code;
+    response_stream >> status_code;
+    std::string status_message;
+    std::getline(response_stream, status_message);
+    if (!response_stream || http_version.substr(0, 5) != "HTTP/")
+        return 0;
+    size_t count = 0;
+    std::string header;
+    while (std::getline(response_stream, header) && header != "\r")
+        count += header.size() > 0;
+    return count + status_code;
+}
+
+size_t view_parse(const std::string& response) {
+    awaitable::byte_view data(response);
+    size_t end = awaitable::find_crlfcrlf(data);
+    awaitable::http_response_head head;
+    if (end == awaitable::byte_view::npos ||
+        !awaitable::parse_http_response_head(data.substr(0, end + 4), head))
+        return 0;
+    return head.header_count + head.status;
+}
+}  // namespace
+
+int http_bench(int argc, char* argv[]) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 200000;
+    int headers = argc > 2 ? std::atoi(argv[2]) : 16;
+    auto response = make_response(headers);
+    // read through a volatile pointer so the loops cannot be hoisted
+    const std::string* volatile input = &response;
+
+    size_t check = 0;
+    double secs = time_seconds([&] {
+        for (int i = 0; i < iterations; ++i)
+            check += istream_parse(*input);
+    });
+    std::printf("%-16s %8.3fs %12.0f heads/s (%zu)\n", "istream+getline", secs, iterations / secs,
+        check);
+    check = 0;
+    secs = time_seconds([&] {
+        for (int i = 0; i < iterations; ++i)
+            check += view_parse(*input);
+    });
+    std::printf("%-16s %8.3fs %12.0f heads/s (%zu)\n", "parse_head", secs, iterations / secs,
+        check);
+
+    // a large head without its terminator, the scan runs over all of it
+    std::string block(1 << 20, 'a');
+    for (size_t i = 40; i < block.size(); i += 41) {
+        block[i - 1] = '\r';
+        block[i] = '\n';
+    }
+    const std::string* volatile scanned = &block;
+    int rounds = 200;
+    for (int pass = 0; pass < 2; ++pass) {
+        check = 0;
+        secs = time_seconds([&] {
+            for (int i = 0; i < rounds; ++i) {
+                awaitable::byte_view data(*scanned);
+                check += pass ? awaitable::find_crlfcrlf(data)
+                              : awaitable::detail::find_pattern_scalar<4>(
+                                    data.data(), data.size(), 0, "\r\n\r\n");
+            }
+        });
+        std::printf("%-16s %8.3fs %12.2f GB/s (%zu)\n", pass ? "scan vector" : "scan memchr",
+            secs, rounds * double(block.size()) / secs / 1e9, check);
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+// load_bench.cpp : open-loop load generator. Requests are due on a fixed
+// schedule of `rate` per second spread over the connections, and their latency
+// is measured from when they were due, not from when they were sent, so a
+// stalled server shows up in the percentiles instead of slowing the load
+// down (coordinated omission). The time from the actual send is reported
+// next to it.
+//
+// A protocol is a type with
+//   static const bool multiplexed;    // several exchanges may share a lane
+//   task<bool> exchange(size_t lane); // one request/response, false on error
+//   void close();                     // ends its connections
+// http_load and rpc_load target servers started in this process.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "asio.hpp"
+#include "asio_http_client.hpp"
+#include "asio_http_server.hpp"
+#include "asio_rpc.hpp"
+#include "asio_use_task.hpp"
+#include "awaitable_histogram.hpp"
+
+namespace {
+using asio::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+struct load_stats {
+    awaitable::histogram latency;
+    awaitable::histogram service;
+    uint64_t errors = 0;
+    uint64_t late = 0;
+    size_t lanes = 0;
+    size_t outstanding = 0;
+};
+
+struct load_schedule {
+    clock_type::time_point start;
+    clock_type::time_point end;
+    // between two requests of the same lane
+    clock_type::duration period;
+    size_t lanes;
+};
+
+uint64_t nanoseconds(clock_type::duration d) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+template<typename Load>
+void lane_done(Load& load, load_stats& stats) {
+    if (!stats.lanes && !stats.outstanding)
+        load.close();
+}
+
+template<typename Load>
+awaitable::task<bool> measured(Load& load, size_t lane, clock_type::time_point due,
+    load_stats& stats) {
+    ++stats.outstanding;
+    auto sent = clock_type::now();
+    bool ok = co_await load.exchange(lane);
+    auto now = clock_type::now();
+    if (ok) {
+        stats.latency.record(nanoseconds(now - due));
+        stats.service.record(nanoseconds(now - sent));
+    } else {
+        ++stats.errors;
+    }
+    --stats.outstanding;
+    lane_done(load, stats);
+    return ok;
+}
+
+// request k of lane i is due at start + (k * lanes + i) / rate
+template<typename Load>
+awaitable::task<int> drive_lane(asio::io_context& io_context, Load& load, size_t lane,
+    load_schedule sched, load_stats& stats) {
+    asio::steady_timer timer(io_context);
+    int issued = 0;
+    auto due = sched.start + sched.period * static_cast<clock_type::rep>(lane) /
+                                 static_cast<clock_type::rep>(sched.lanes);
+    for (; due < sched.end; due += sched.period, ++issued) {
+        if (due > clock_type::now()) {
+            timer.expires_at(due);
+            co_await timer.async_wait(asio::use_task_ec);
+        } else if (clock_type::now() - due > sched.period) {
+            // still owed from before, sent at once and charged from its due time
+            ++stats.late;
+        }
+        auto exchange = measured(load, lane, due, stats);
+        if (!Load::multiplexed)
+            co_await exchange;
+    }
+    --stats.lanes;
+    lane_done(load, stats);
+    return issued;
+}
+
+class http_load {
+  public:
+    static const bool multiplexed = false;
+
+    http_load(asio::io_context& io_context, unsigned short port, size_t lanes)
+        : _client(io_context, options(lanes)), _port(std::to_string(port)) {
+        _req.target = "/";
+    }
+
+    awaitable::task<bool> exchange(size_t) {
+        auto [ec, resp] = co_await _client.request("127.0.0.1", _port, _req);
+        return !ec && resp.status == 200;
+    }
+    void close() { _client.close_idle(); }
+    size_t connects() const { return _client.connects(); }
+
+  private:
+    static awaitable::http_client_options options(size_t lanes) {
+        awaitable::http_client_options opts;
+        opts.max_per_host = lanes;
+        opts.max_idle_per_host = lanes;
+        return opts;
+    }
+
+    awaitable::http_client _client;
+    std::string _port;
+    awaitable::http_request _req;
+};
+
+class rpc_load {
+  public:
+    static const bool multiplexed = true;
+
+    rpc_load(asio::io_context& io_context, const tcp::endpoint& endpoint, size_t lanes,
+        size_t payload)
+        : _payload(payload, 'x') {
+        for (size_t i = 0; i < lanes; ++i) {
+            tcp::socket socket(io_context);
+            socket.connect(endpoint);
+            socket.set_option(tcp::no_delay(true));
+            _clients.emplace_back(new awaitable::rpc_client<tcp::socket>(std::move(socket)));
+        }
+    }
+
+    awaitable::task<bool> exchange(size_t lane) {
+        auto [ec, resp] = co_await _clients[lane]->call(1, _payload);
+        return !ec && resp.status == awaitable::rpc_status_ok;
+    }
+    void close() {
+        for (auto& client : _clients)
+            client->close();
+    }
+    size_t connects() const { return _clients.size(); }
+
+  private:
+    std::vector<std::unique_ptr<awaitable::rpc_client<tcp::socket>>> _clients;
+    std::string _payload;
+};
+
+template<typename Load>
+void generate(asio::io_context& io_context, Load& load, double rate, size_t lanes, int seconds,
+    const char* name) {
+    load_stats stats;
+    load_schedule sched;
+    // the first requests are due once every lane has started
+    sched.start = clock_type::now() + std::chrono::milliseconds(10);
+    sched.end = sched.start + std::chrono::seconds(seconds);
+    sched.period = std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(double(lanes) / rate));
+    sched.lanes = lanes;
+    stats.lanes = lanes;
+    for (size_t i = 0; i < lanes; ++i)
+        drive_lane(io_context, load, i, sched, stats);
+    io_context.run();
+    // behind schedule the run outlasts `seconds`
+    auto elapsed = std::chrono::duration<double>(clock_type::now() - sched.start).count();
+
+    auto done = stats.latency.count();
+    std::printf("%s rate %.0f/s connections %zu (%zu opened): %llu done, %.0f/s, %llu errors, "
+                "%llu sent late\n",
+        name, rate, lanes, load.connects(), static_cast<unsigned long long>(done),
+        double(done) / elapsed, static_cast<unsigned long long>(stats.errors),
+        static_cast<unsigned long long>(stats.late));
+    for (auto* h : {&stats.latency, &stats.service}) {
+        std::printf("%s us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+            h == &stats.latency ? "latency" : "service", h->percentile(50) / 1e3,
+            h->percentile(90) / 1e3, h->percentile(99) / 1e3, h->percentile(99.9) / 1e3,
+            h->max() / 1e3);
+    }
+}
+
+awaitable::task<int> accept_rpc(tcp::acceptor& acceptor, awaitable::rpc_server& server, int count) {
+    for (int i = 0; i < count; ++i) {
+        auto ret = co_await acceptor.async_accept(asio::use_task_ec);
+        if (NS_VARIANT::get_if<asio::error_code>(&ret))
+            return i;
+        server.serve(tcp::socket(std::move(NS_VARIANT::get<1>(ret))));
+    }
+    return count;
+}
+
+int http_target(double rate, size_t lanes, int seconds) {
+    awaitable::http_server server(
+        [](const awaitable::http_request_head&, awaitable::byte_view)
+            -> awaitable::task<awaitable::http_response> {
+            awaitable::http_response resp;
+            resp.body = "hello world";
+            co_await awaitable::ex::suspend_never{};
+            return resp;
+        });
+    auto port = server.listen(tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    server.start();
+    {
+        asio::io_context io_context(1);
+        http_load load(io_context, port, lanes);
+        generate(io_context, load, rate, lanes, seconds, "http");
+    }
+    server.stop();
+    server.join();
+    return 0;
+}
+
+int rpc_target(double rate, size_t lanes, int seconds) {
+    asio::io_context server_context(1);
+    tcp::acceptor acceptor(server_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    awaitable::rpc_server server(
+        [](uint32_t, awaitable::byte_view payload) -> awaitable::task<awaitable::rpc_response> {
+            awaitable::rpc_response resp;
+            resp.payload = payload.to_string();
+            co_await awaitable::ex::suspend_never{};
+            return resp;
+        });
+    accept_rpc(acceptor, server, static_cast<int>(lanes));
+    std::thread server_thread([&] { server_context.run(); });
+    {
+        asio::io_context io_context(1);
+        rpc_load load(io_context, acceptor.local_endpoint(), lanes, 64);
+        generate(io_context, load, rate, lanes, seconds, "rpc");
+    }
+    server_thread.join();
+    return 0;
+}
+}  // namespace
+
+int load_bench(int argc, char* argv[]) {
+    const char* protocol = argc > 1 ? argv[1] : "http";
+    double rate = argc > 2 ? std::atof(argv[2]) : 10000;
+    int connections = argc > 3 ? std::atoi(argv[3]) : 16;
+    int seconds = argc > 4 ? std::atoi(argv[4]) : 5;
+    size_t lanes = connections > 0 ? static_cast<size_t>(connections) : 1;
+    if (rate <= 0 || seconds <= 0)
+        return 1;
+    if (std::strcmp(protocol, "http") == 0)
+        return http_target(rate, lanes, seconds);
+    if (std::strcmp(protocol, "rpc") == 0)
+        return rpc_target(rate, lanes, seconds);
+    return 1;
+}
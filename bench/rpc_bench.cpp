@@ -0,0 +1,107 @@
+// rpc_bench.cpp : echo calls per second through rpc_client/rpc_server over
+// loopback TCP, with `in_flight` callers sharing each connection, and how many
+// frames the client's writes carried on average.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "asio.hpp"
+#include "asio_rpc.hpp"
+#include "asio_use_task.hpp"
+#include "awaitable_histogram.hpp"
+
+namespace {
+using asio::ip::tcp;
+
+awaitable::task<uint64_t> echo_caller(awaitable::rpc_client<tcp::socket>& client,
+    const std::string& payload,
+    const std::atomic<bool>& stop,
+    awaitable::histogram& latency) {
+    uint64_t calls = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        auto start = std::chrono::steady_clock::now();
+        auto [ec, resp] = co_await client.call(1, payload);
+        if (ec)
+            return calls;
+        latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+        ++calls;
+    }
+    return calls;
+}
+
+awaitable::task<int> accept_rpc(tcp::acceptor& acceptor, awaitable::rpc_server& server, int count) {
+    for (int i = 0; i < count; ++i) {
+        auto ret = co_await acceptor.async_accept(asio::use_task_ec);
+        if (NS_VARIANT::get_if<asio::error_code>(&ret))
+            return i;
+        server.serve(tcp::socket(std::move(NS_VARIANT::get<1>(ret))));
+    }
+    return count;
+}
+}  // namespace
+
+int rpc_bench(int argc, char* argv[]) {
+    int connections = argc > 1 ? std::atoi(argv[1]) : 4;
+    int in_flight = argc > 2 ? std::atoi(argv[2]) : 32;
+    int seconds = argc > 3 ? std::atoi(argv[3]) : 5;
+    size_t payload_size = argc > 4 ? static_cast<size_t>(std::atoi(argv[4])) : 64;
+
+    asio::io_context server_context(1);
+    tcp::acceptor acceptor(server_context, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    awaitable::rpc_server server(
+        [](uint32_t, awaitable::byte_view payload) -> awaitable::task<awaitable::rpc_response> {
+            awaitable::rpc_response resp;
+            resp.payload = payload.to_string();
+            co_await awaitable::ex::suspend_never{};
+            return resp;
+        });
+    accept_rpc(acceptor, server, connections);
+    std::thread server_thread([&] { server_context.run(); });
+
+    asio::io_context io_context(1);
+    std::vector<std::unique_ptr<awaitable::rpc_client<tcp::socket>>> clients;
+    for (int i = 0; i < connections; ++i) {
+        tcp::socket socket(io_context);
+        socket.connect(acceptor.local_endpoint());
+        socket.set_option(tcp::no_delay(true));
+        clients.emplace_back(new awaitable::rpc_client<tcp::socket>(std::move(socket)));
+    }
+    std::string payload(payload_size, 'x');
+    std::atomic<bool> stop{false};
+    awaitable::histogram latency;
+    for (auto& client : clients) {
+        for (int i = 0; i < in_flight; ++i)
+            echo_caller(*client, payload, stop, latency);
+    }
+    asio::steady_timer timer(io_context, std::chrono::seconds(seconds));
+    timer.async_wait([&](const asio::error_code&) {
+        stop = true;
+        // the callers finish their current call, then the connections close
+        asio::post(io_context, [&] {
+            for (auto& client : clients)
+                client->close();
+        });
+    });
+    io_context.run();
+    // the server's connections end with the clients' and its run returns
+    server_thread.join();
+
+    size_t writes = 0;
+    for (auto& client : clients)
+        writes += client->writes();
+    uint64_t calls = latency.count();
+    std::printf("connections %d in flight %d payload %zu: %llu calls, %.0f calls/s, "
+                "%.1f frames/write\n",
+        connections, in_flight, payload_size, static_cast<unsigned long long>(calls),
+        double(calls) / seconds, writes ? double(calls) / double(writes) : 0.0);
+    std::printf("latency us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+        latency.percentile(50) / 1e3, latency.percentile(90) / 1e3, latency.percentile(99) / 1e3,
+        latency.percentile(99.9) / 1e3, latency.max() / 1e3);
+    return 0;
+}
@@ -0,0 +1,116 @@
+// server_bench.cpp : requests/sec and latency percentiles of http_server over
+// loopback. Every client connection keeps `pipeline` requests in flight and
+// records the time from writing them to reading the last response.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+#include "asio.hpp"
+#include "asio_http_server.hpp"
+#include "awaitable_histogram.hpp"
+
+namespace {
+using asio::ip::tcp;
+
+awaitable::task<uint64_t> load_connection(asio::io_context& io_context,
+    tcp::endpoint endpoint,
+    int pipeline,
+    const std::atomic<bool>& stop,
+    awaitable::histogram& latency) {
+    tcp::socket socket(io_context);
+    auto connected = co_await socket.async_connect(endpoint, asio::use_task_ec);
+    if (connected)
+        return 0;
+    awaitable::socket_reader<tcp::socket> reader(socket);
+    std::string wire;
+    for (int i = 0; i < pipeline; ++i)
+        wire += "GET / HTTP/1.1\r\nHost: bench\r\n\r\n";
+    uint64_t done = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+        auto start = std::chrono::steady_clock::now();
+        auto written = co_await asio::async_write(socket, asio::buffer(wire), asio::use_task_ec);
+        if (NS_VARIANT::get_if<asio::error_code>(&written))
+            return done;
+        for (int i = 0; i < pipeline; ++i) {
+            auto [ec, data] = co_await reader.read_until("\r\n\r\n");
+            awaitable::http_response_head head;
+            uint64_t length = 0;
+            if (ec || !awaitable::parse_http_response_head(data, head) ||
+                !awaitable::parse_http_length(head.find("content-length"), length))
+                return done;
+            auto [body_ec, body] = co_await reader.read_exact(static_cast<size_t>(length));
+            if (body_ec)
+                return done;
+        }
+        latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count()));
+        done += pipeline;
+    }
+    asio::error_code ignored;
+    socket.shutdown(tcp::socket::shutdown_send, ignored);
+    return done;
+}
+}  // namespace
+
+int server_bench(int argc, char* argv[]) {
+    unsigned threads = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : 2;
+    int connections = argc > 2 ? std::atoi(argv[2]) : 64;
+    int seconds = argc > 3 ? std::atoi(argv[3]) : 5;
+    int pipeline = argc > 4 ? std::atoi(argv[4]) : 1;
+    threads = threads ? threads : 1;
+    pipeline = pipeline > 0 ? pipeline : 1;
+
+    awaitable::http_server_options opts;
+    opts.threads = threads;
+    awaitable::http_server server(
+        [](const awaitable::http_request_head&, awaitable::byte_view)
+            -> awaitable::task<awaitable::http_response> {
+            awaitable::http_response resp;
+            resp.body = "hello world";
+            co_await awaitable::ex::suspend_never{};
+            return resp;
+        },
+        opts);
+    auto port = server.listen(tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    server.start();
+
+    // as many client threads as server threads, connections spread over them
+    std::atomic<bool> stop{false};
+    std::vector<std::unique_ptr<awaitable::histogram>> latencies;
+    std::vector<std::thread> clients;
+    for (unsigned t = 0; t < threads; ++t) {
+        latencies.emplace_back(new awaitable::histogram());
+        auto& latency = *latencies.back();
+        int count = connections / static_cast<int>(threads) +
+                    (static_cast<int>(t) < connections % static_cast<int>(threads));
+        clients.emplace_back([&, count] {
+            asio::io_context io_context(1);
+            tcp::endpoint endpoint(asio::ip::address_v4::loopback(), port);
+            for (int i = 0; i < count; ++i)
+                load_connection(io_context, endpoint, pipeline, stop, latency);
+            io_context.run();
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& client : clients)
+        client.join();
+    server.stop();
+    server.join();
+
+    awaitable::histogram latency;
+    for (auto& h : latencies)
+        latency.merge(*h);
+    uint64_t total = server.requests();
+    std::printf("threads %u connections %d pipeline %d: %llu requests, %.0f req/s\n", threads,
+        connections, pipeline, static_cast<unsigned long long>(total), double(total) / seconds);
+    std::printf("latency us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+        latency.percentile(50) / 1e3, latency.percentile(90) / 1e3, latency.percentile(99) / 1e3,
+        latency.percentile(99.9) / 1e3, latency.max() / 1e3);
+    return 0;
+}
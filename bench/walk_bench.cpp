@@ -0,0 +1,113 @@
+// walk_bench.cpp : awaitable::walk against a single-threaded readdir/lstat walk
+// over a generated tree. The walker uses getdents64, elsewhere the bench only
+// says so.
+//
+
+#include "bench.h"
+
+#if defined(__linux__)
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "asio.hpp"
+#include "asio_dir_walk.hpp"
+
+namespace {
+size_t generate_tree(const std::string& dir, int depth, int fanout, int files) {
+    ::mkdir(dir.c_str(), 0755);
+    size_t count = 0;
+    for (int i = 0; i < files; ++i) {
+        auto path = dir + "/file" + std::to_string(i);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            ::close(fd);
+            ++count;
+        }
+    }
+    if (depth > 0) {
+        for (int i = 0; i < fanout; ++i)
+            count += 1 + generate_tree(dir + "/dir" + std::to_string(i), depth - 1, fanout, files);
+    }
+    return count;
+}
+
+size_t readdir_walk(const std::string& dir) {
+    DIR* d = ::opendir(dir.c_str());
+    if (!d)
+        return 0;
+    size_t count = 0;
+    while (auto ent = ::readdir(d)) {
+        if (std::strcmp(ent->d_name, ".") == 0 || std::strcmp(ent->d_name, "..") == 0)
+            continue;
+        auto path = dir + "/" + ent->d_name;
+        struct stat st;
+        if (::lstat(path.c_str(), &st) != 0)
+            continue;
+        ++count;
+        if (S_ISDIR(st.st_mode))
+            count += readdir_walk(path);
+    }
+    ::closedir(d);
+    return count;
+}
+
+awaitable::task<size_t> run_walk(asio::io_context& io_context,
+    awaitable::blocking_pool& pool,
+    const std::string& root,
+    size_t concurrency) {
+    awaitable::walk_options opts;
+    opts.concurrency = concurrency;
+    size_t files = 0;
+    auto ret = co_await awaitable::walk(io_context, pool, root,
+        [&files](const std::vector<awaitable::dir_entry>& entries) {
+            for (auto& e : entries)
+                files += e.type == DT_REG;
+        },
+        opts);
+    if (std::get<0>(ret))
+        std::printf("walk error: %s\n", std::get<0>(ret).message().c_str());
+    return std::get<1>(ret);
+}
+}  // namespace
+
+int walk_bench(int argc, char* argv[]) {
+    std::string root = argc > 1 ? argv[1] : "walk_bench_tree";
+    int depth = argc > 2 ? std::atoi(argv[2]) : 4;
+    int fanout = argc > 3 ? std::atoi(argv[3]) : 8;
+    int files = argc > 4 ? std::atoi(argv[4]) : 32;
+
+    struct stat st;
+    if (::stat(root.c_str(), &st) != 0) {
+        size_t created = 0;
+        double secs = time_seconds([&] { created = generate_tree(root, depth, fanout, files); });
+        std::printf("generated %zu entries in %.2fs\n", created, secs);
+    }
+
+    size_t baseline = 0;
+    double secs = time_seconds([&] { baseline = readdir_walk(root); });
+    std::printf("%-14s %10zu entries %8.3fs %12.0f entries/s\n", "readdir+lstat", baseline, secs,
+        baseline / secs);
+
+    for (size_t concurrency : {1, 2, 4, 8, 16}) {
+        asio::io_context io_context;
+        awaitable::blocking_pool pool(concurrency);
+        size_t visited = 0;
+        secs = time_seconds([&] {
+            run_walk(io_context, pool, root, concurrency).then([&visited](size_t n) { visited = n; });
+            io_context.run();
+        });
+        std::printf("walk x%-7zu %10zu entries %8.3fs %12.0f entries/s\n", concurrency, visited,
+            secs, visited / secs);
+    }
+    return 0;
+}
+#else
+int walk_bench(int, char*[]) {
+    std::printf("walk: the directory walker needs Linux\n");
+    return 1;
+}
+#endif  // defined(__linux__)
@@ -0,0 +1,331 @@
+#ifndef AWAITABLE_BUFFERS_H
+#define AWAITABLE_BUFFERS_H
+
+#pragma once
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Buffers for awaitable i/o: fixed-size chunks recycled through a per-thread
+// pool, reference-counted slices that can be handed between coroutines without
+// copying, and chains of slices for scatter/gather i/o.
+namespace awaitable {
+class byte_view {
+  public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    byte_view() = default;
+    byte_view(const char* data, size_t size) noexcept : _data(data), _size(size) {}
+    byte_view(const std::string& str) noexcept : _data(str.data()), _size(str.size()) {}
+    template<size_t N>
+    byte_view(const char (&str)[N]) noexcept : _data(str), _size(N - 1) {}
+
+    const char* data() const noexcept { return _data; }
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+    const char* begin() const noexcept { return _data; }
+    const char* end() const noexcept { return _data + _size; }
+    char operator[](size_t idx) const noexcept { return _data[idx]; }
+
+    byte_view substr(size_t pos, size_t len = npos) const noexcept {
+        pos = pos < _size ? pos : _size;
+        return byte_view(_data + pos, len < _size - pos ? len : _size - pos);
+    }
+    size_t find(char c, size_t pos = 0) const noexcept {
+        if (pos >= _size)
+            return npos;
+        auto found = static_cast<const char*>(std::memchr(_data + pos, c, _size - pos));
+        return found ? static_cast<size_t>(found - _data) : npos;
+    }
+    size_t find(byte_view needle, size_t pos = 0) const noexcept {
+        if (needle.empty())
+            return pos <= _size ? pos : npos;
+        while (pos + needle.size() <= _size) {
+            pos = find(needle[0], pos);
+            if (pos == npos || pos + needle.size() > _size)
+                return npos;
+            if (std::memcmp(_data + pos, needle.data(), needle.size()) == 0)
+                return pos;
+            ++pos;
+        }
+        return npos;
+    }
+    bool starts_with(byte_view prefix) const noexcept {
+        return prefix.size() <= _size && std::memcmp(_data, prefix.data(), prefix.size()) == 0;
+    }
+    std::string to_string() const { return std::string(_data, _size); }
+
+    friend bool operator==(byte_view lhs, byte_view rhs) noexcept {
+        return lhs.size() == rhs.size() && std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+    }
+    friend bool operator!=(byte_view lhs, byte_view rhs) noexcept { return !(lhs == rhs); }
+
+  private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+};
+
+namespace detail {
+struct buffer_pool_core;
+
+struct buffer_chunk {
+    std::atomic<uint32_t> refs;
+    buffer_pool_core* pool;
+    buffer_chunk* next;
+    size_t capacity;
+    char* data() noexcept { return reinterpret_cast<char*>(this + 1); }
+};
+
+// Owned by the pool's thread and by every chunk it handed out, so slices may
+// outlive the thread. Chunks released on other threads go to remote_free and
+// are picked up by the owner on its next allocation.
+struct buffer_pool_core {
+    std::atomic<uint32_t> refs{1};
+    std::atomic<bool> owner_alive{true};
+    std::thread::id owner = std::this_thread::get_id();
+    size_t chunk_size;
+    size_t max_cached;
+    buffer_chunk* local_free = nullptr;
+    size_t local_count = 0;
+    std::atomic<buffer_chunk*> remote_free{nullptr};
+
+    buffer_pool_core(size_t size, size_t cached) : chunk_size(size), max_cached(cached) {}
+    ~buffer_pool_core() {
+        free_list(local_free);
+        free_list(remote_free.exchange(nullptr));
+    }
+
+    static void free_list(buffer_chunk* chunk) noexcept {
+        while (chunk) {
+            auto next = chunk->next;
+            ::operator delete(chunk);
+            chunk = next;
+        }
+    }
+    void release() noexcept {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    buffer_chunk* allocate() {
+        if (!local_free) {
+            local_free = remote_free.exchange(nullptr, std::memory_order_acquire);
+            local_count = 0;
+            for (auto c = local_free; c; c = c->next)
+                ++local_count;
+        }
+        buffer_chunk* chunk = local_free;
+        if (chunk) {
+            local_free = chunk->next;
+            --local_count;
+        } else {
+            chunk = static_cast<buffer_chunk*>(::operator new(sizeof(buffer_chunk) + chunk_size));
+            chunk->pool = this;
+            chunk->capacity = chunk_size;
+        }
+        chunk->refs.store(1, std::memory_order_relaxed);
+        chunk->next = nullptr;
+        refs.fetch_add(1, std::memory_order_relaxed);
+        return chunk;
+    }
+
+    void recycle(buffer_chunk* chunk) noexcept {
+        if (owner_alive.load(std::memory_order_acquire)) {
+            if (std::this_thread::get_id() == owner) {
+                if (local_count < max_cached) {
+                    chunk->next = local_free;
+                    local_free = chunk;
+                    ++local_count;
+                } else {
+                    ::operator delete(chunk);
+                }
+            } else {
+                auto head = remote_free.load(std::memory_order_relaxed);
+                do {
+                    chunk->next = head;
+                } while (!remote_free.compare_exchange_weak(
+                    head, chunk, std::memory_order_release, std::memory_order_relaxed));
+            }
+        } else {
+            ::operator delete(chunk);
+        }
+        release();
+    }
+};
+
+inline void release_chunk(buffer_chunk* chunk) noexcept {
+    if (chunk && chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        chunk->pool->recycle(chunk);
+}
+}  // namespace detail
+
+class buffer_slice;
+
+class buffer_pool {
+  public:
+    explicit buffer_pool(size_t chunk_size = default_chunk_size, size_t max_cached = 256)
+        : _core(new detail::buffer_pool_core(chunk_size, max_cached)) {}
+    ~buffer_pool() {
+        _core->owner_alive.store(false, std::memory_order_release);
+        detail::buffer_pool_core::free_list(_core->local_free);
+        _core->local_free = nullptr;
+        _core->release();
+    }
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    size_t chunk_size() const noexcept { return _core->chunk_size; }
+    size_t cached() const noexcept { return _core->local_count; }
+
+    // a writable slice covering a whole chunk, only call on the pool's thread
+    inline buffer_slice allocate();
+
+    // the calling thread's pool for chunks of at least min_size bytes, sizes are powers of two
+    static buffer_pool& local(size_t min_size = default_chunk_size) {
+        size_t size_class = 0;
+        while ((min_chunk_size << size_class) < min_size && size_class + 1 < size_classes)
+            ++size_class;
+        thread_local std::unique_ptr<buffer_pool> pools[size_classes];
+        auto& pool = pools[size_class];
+        if (!pool)
+            pool.reset(new buffer_pool(min_chunk_size << size_class));
+        return *pool;
+    }
+
+    enum : size_t {
+        min_chunk_size = 4096,
+        default_chunk_size = 16384,
+        size_classes = 9,  // 4k .. 1m
+    };
+
+  private:
+    detail::buffer_pool_core* _core;
+};
+
+// A reference-counted view into a pooled chunk. Copies share the chunk, the
+// chunk goes back to its pool when the last slice is gone. Write through data()
+// before handing the slice out, shared slices are treated as read-only.
+class buffer_slice {
+  public:
+    buffer_slice() = default;
+    buffer_slice(const buffer_slice& rhs) noexcept
+        : _chunk(rhs._chunk), _offset(rhs._offset), _size(rhs._size) {
+        if (_chunk)
+            _chunk->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    buffer_slice(buffer_slice&& rhs) noexcept
+        : _chunk(rhs._chunk), _offset(rhs._offset), _size(rhs._size) {
+        rhs._chunk = nullptr;
+        rhs._offset = rhs._size = 0;
+    }
+    buffer_slice& operator=(buffer_slice rhs) noexcept {
+        swap(rhs);
+        return *this;
+    }
+    ~buffer_slice() { detail::release_chunk(_chunk); }
+
+    void swap(buffer_slice& rhs) noexcept {
+        std::swap(_chunk, rhs._chunk);
+        std::swap(_offset, rhs._offset);
+        std::swap(_size, rhs._size);
+    }
+    void reset() noexcept { buffer_slice().swap(*this); }
+
+    char* data() noexcept { return _chunk ? _chunk->data() + _offset : nullptr; }
+    const char* data() const noexcept { return _chunk ? _chunk->data() + _offset : nullptr; }
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+    explicit operator bool() const noexcept { return _chunk != nullptr; }
+    // bytes available from the start of the slice to the end of its chunk
+    size_t capacity() const noexcept { return _chunk ? _chunk->capacity - _offset : 0; }
+    bool unique() const noexcept {
+        return _chunk && _chunk->refs.load(std::memory_order_acquire) == 1;
+    }
+
+    void resize(size_t size) noexcept { _size = size < capacity() ? size : capacity(); }
+    void consume(size_t count) noexcept {
+        count = count < _size ? count : _size;
+        _offset += count;
+        _size -= count;
+    }
+    buffer_slice slice(size_t pos, size_t len = byte_view::npos) const noexcept {
+        buffer_slice sub(*this);
+        sub.consume(pos);
+        sub._size = len < sub._size ? len : sub._size;
+        return sub;
+    }
+    byte_view view() const noexcept { return byte_view(data(), _size); }
+
+  private:
+    friend class buffer_pool;
+    explicit buffer_slice(detail::buffer_chunk* chunk) noexcept
+        : _chunk(chunk), _size(chunk->capacity) {}
+
+    detail::buffer_chunk* _chunk = nullptr;
+    size_t _offset = 0;
+    size_t _size = 0;
+};
+
+inline buffer_slice buffer_pool::allocate() {
+    return buffer_slice(_core->allocate());
+}
+
+// An ordered list of slices read or written as one, e.g. with writev.
+class buffer_chain {
+  public:
+    void push_back(buffer_slice slice) {
+        _bytes += slice.size();
+        _slices.push_back(std::move(slice));
+    }
+    void clear() noexcept {
+        _slices.clear();
+        _bytes = 0;
+    }
+    // drops count bytes from the front, e.g. after a partial write
+    void consume(size_t count) {
+        size_t drop = 0;
+        while (count && drop < _slices.size()) {
+            auto& front = _slices[drop];
+            if (count < front.size()) {
+                front.consume(count);
+                _bytes -= count;
+                break;
+            }
+            count -= front.size();
+            _bytes -= front.size();
+            ++drop;
+        }
+        _slices.erase(_slices.begin(), _slices.begin() + drop);
+    }
+
+    size_t size() const noexcept { return _bytes; }
+    bool empty() const noexcept { return _bytes == 0; }
+    size_t count() const noexcept { return _slices.size(); }
+    const buffer_slice& operator[](size_t idx) const noexcept { return _slices[idx]; }
+    std::vector<buffer_slice>::const_iterator begin() const noexcept { return _slices.begin(); }
+    std::vector<buffer_slice>::const_iterator end() const noexcept { return _slices.end(); }
+
+    // a buffer sequence for vectored i/o, e.g. chain.buffers<asio::const_buffer>()
+    template<typename Buffer>
+    std::vector<Buffer> buffers(size_t max_count = byte_view::npos) const {
+        std::vector<Buffer> seq;
+        seq.reserve(_slices.size() < max_count ? _slices.size() : max_count);
+        for (auto& s : _slices) {
+            if (seq.size() == max_count)
+                break;
+            if (!s.empty())
+                seq.emplace_back(s.data(), s.size());
+        }
+        return seq;
+    }
+
+  private:
+    std::vector<buffer_slice> _slices;
+    size_t _bytes = 0;
+};
+}  // namespace awaitable
+#endif  // !defined(AWAITABLE_BUFFERS_H)
@@ -0,0 +1,162 @@
+#ifndef AWAITABLE_HANDLER_MEMORY_H
+#define AWAITABLE_HANDLER_MEMORY_H
+
+#pragma once
+#include <cstddef>
+#include <new>
+
+// Recycled memory for the operations started by one socket or coroutine. An
+// asio operation allocates its operation object and the shared state of its
+// promise, a steady loop of reads asks for the same sizes every time, so the
+// blocks are kept when freed and handed out again for the next operation.
+//
+// The blocks are shared with the operations: an operation still pending when
+// the handler_memory is destroyed keeps its block until it completes, the
+// others are freed at once. A coroutine may own one even when it is reset
+// with an operation in flight, whose completion arrives after the frame is
+// gone. Plain use_task allocates from the heap for every operation, only
+// operations given a handler_allocator through the token reuse blocks.
+namespace awaitable {
+namespace detail {
+class handler_slots {
+  public:
+    // a read loop keeps the previous state alive while the next op allocates
+    // its state and operation object, four covers that plus a concurrent write
+    enum : size_t { slot_count = 4 };
+
+    void* allocate(size_t size) {
+        if (_orphaned)
+            return allocate_unslotted(size);
+        slot* empty = nullptr;
+        for (auto& s : _slots) {
+            if (s.in_use)
+                continue;
+            if (s.size >= size) {
+                s.in_use = true;
+                return s.data;
+            }
+            if (!empty || s.size < empty->size)
+                empty = &s;
+        }
+        if (!empty)
+            return allocate_unslotted(size);
+        // the smallest free block is too small for this size, grow it
+        ::operator delete(empty->data);
+        empty->data = nullptr;
+        empty->size = 0;
+        empty->data = ::operator new(size);
+        empty->size = size;
+        empty->in_use = true;
+        return empty->data;
+    }
+    void deallocate(void* p) noexcept {
+        for (auto& s : _slots) {
+            if (s.data == p) {
+                s.in_use = false;
+                if (_orphaned)
+                    release();
+                return;
+            }
+        }
+        ::operator delete(p);
+        --_unslotted;
+        if (_orphaned)
+            release();
+    }
+
+    size_t cached() const noexcept {
+        size_t count = 0;
+        for (auto& s : _slots)
+            count += s.data && !s.in_use;
+        return count;
+    }
+
+    // the owner is gone, frees the idle blocks, and itself once no block
+    // it handed out is left, slotted or not
+    void release() noexcept {
+        _orphaned = true;
+        bool busy = false;
+        for (auto& s : _slots) {
+            if (s.in_use) {
+                busy = true;
+            } else {
+                ::operator delete(s.data);
+                s.data = nullptr;
+                s.size = 0;
+            }
+        }
+        if (!busy && !_unslotted)
+            delete this;
+    }
+
+  private:
+    // every slot busy, the block is freed through deallocate all the same
+    void* allocate_unslotted(size_t size) {
+        void* p = ::operator new(size);
+        ++_unslotted;
+        return p;
+    }
+
+    struct slot {
+        void* data = nullptr;
+        size_t size = 0;
+        bool in_use = false;
+    };
+    slot _slots[slot_count];
+    // heap blocks handed out beyond the slots and not freed yet
+    size_t _unslotted = 0;
+    bool _orphaned = false;
+};
+}  // namespace detail
+
+class handler_memory {
+  public:
+    enum : size_t { slot_count = detail::handler_slots::slot_count };
+
+    handler_memory() : _slots(new detail::handler_slots()) {}
+    ~handler_memory() { _slots->release(); }
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    // not thread safe, use from the thread running the operations' handlers
+    void* allocate(size_t size) { return _slots->allocate(size); }
+    void deallocate(void* p) noexcept { _slots->deallocate(p); }
+
+    size_t cached() const noexcept { return _slots->cached(); }
+
+  private:
+    template<typename T>
+    friend class handler_allocator;
+    detail::handler_slots* _slots;
+};
+
+// co_await socket.async_read_some(buf, asio::use_task[handler_allocator<void>(memory)]);
+// the operation object and the shared state come from memory's slots.
+template<typename T>
+class handler_allocator {
+  public:
+    using value_type = T;
+
+    explicit handler_allocator(handler_memory& memory) noexcept : _slots(memory._slots) {}
+    template<typename U>
+    handler_allocator(const handler_allocator<U>& rhs) noexcept : _slots(rhs._slots) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(_slots->allocate(sizeof(T) * n)); }
+    void deallocate(T* p, size_t) noexcept { _slots->deallocate(p); }
+
+    template<typename U>
+    bool operator==(const handler_allocator<U>& rhs) const noexcept {
+        return _slots == rhs._slots;
+    }
+    template<typename U>
+    bool operator!=(const handler_allocator<U>& rhs) const noexcept {
+        return _slots != rhs._slots;
+    }
+
+  private:
+    template<typename U>
+    friend class handler_allocator;
+    detail::handler_slots* _slots;
+};
+}  // namespace awaitable
+#endif  // !defined(AWAITABLE_HANDLER_MEMORY_H)
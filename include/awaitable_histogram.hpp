@@ -0,0 +1,121 @@
+#ifndef AWAITABLE_HISTOGRAM_H
+#define AWAITABLE_HISTOGRAM_H
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Log-linear histogram for latencies and sizes. A value falls in the bucket
+// of its highest set bit, split into sub_count linear steps, so a bucket is
+// never wider than 1/sub_count of the values in it. Recording is a relaxed
+// fetch_add and may happen on any thread; readers see a snapshot that is
+// good enough for reporting.
+namespace awaitable {
+class histogram {
+  public:
+    enum : unsigned {
+        sub_bits = 4,
+        sub_count = 1u << sub_bits,
+        bucket_count = (64 - sub_bits + 1) * sub_count,
+    };
+
+    histogram() noexcept { reset(); }
+    histogram(const histogram&) = delete;
+    histogram& operator=(const histogram&) = delete;
+
+    void record(uint64_t value) noexcept {
+        _buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(value, std::memory_order_relaxed);
+        auto max = _max.load(std::memory_order_relaxed);
+        while (value > max &&
+               !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // adds the counts of other, e.g. per-thread histograms into one for reporting
+    void merge(const histogram& other) noexcept {
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            auto n = other._buckets[i].load(std::memory_order_relaxed);
+            if (n)
+                _buckets[i].fetch_add(n, std::memory_order_relaxed);
+        }
+        _count.fetch_add(other.count(), std::memory_order_relaxed);
+        _sum.fetch_add(other._sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        auto value = other.max();
+        auto max = _max.load(std::memory_order_relaxed);
+        while (value > max &&
+               !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    void reset() noexcept {
+        for (auto& bucket : _buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        _count.store(0, std::memory_order_relaxed);
+        _sum.store(0, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const noexcept { return _count.load(std::memory_order_relaxed); }
+    uint64_t max() const noexcept { return _max.load(std::memory_order_relaxed); }
+    double mean() const noexcept {
+        auto n = count();
+        return n ? double(_sum.load(std::memory_order_relaxed)) / double(n) : 0.0;
+    }
+
+    // upper bound of the bucket holding the value below which percent of the
+    // recorded values fall, 0 when nothing was recorded
+    uint64_t percentile(double percent) const noexcept {
+        auto n = count();
+        if (!n)
+            return 0;
+        auto rank = static_cast<uint64_t>(percent / 100.0 * double(n) + 0.5);
+        rank = rank ? (rank < n ? rank : n) : 1;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            seen += _buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                auto upper = bucket_upper(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    static unsigned bucket_of(uint64_t value) noexcept {
+        if (value < sub_count)
+            return static_cast<unsigned>(value);
+        unsigned shift = highest_bit(value) - sub_bits;
+        return (shift + 1) * sub_count + static_cast<unsigned>((value >> shift) & (sub_count - 1));
+    }
+    static uint64_t bucket_upper(unsigned idx) noexcept {
+        if (idx < sub_count)
+            return idx;
+        unsigned shift = idx / sub_count - 1;
+        uint64_t lower = uint64_t(sub_count + idx % sub_count) << shift;
+        return lower + ((uint64_t(1) << shift) - 1);
+    }
+
+  private:
+    static unsigned highest_bit(uint64_t value) noexcept {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse64(&idx, value);
+        return idx;
+#else
+        return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    std::atomic<uint64_t> _buckets[bucket_count];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+}  // namespace awaitable
+#endif  // !defined(AWAITABLE_HISTOGRAM_H)
@@ -0,0 +1,338 @@
+#ifndef AWAITABLE_HTTP_H
+#define AWAITABLE_HTTP_H
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "awaitable_buffers.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AWAITABLE_HTTP_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define AWAITABLE_HTTP_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// HTTP/1.x message heads parsed in place. The CRLF and CRLFCRLF scanners
+// test 32 or 16 positions per step with AVX2 or SSE2, picked at compile time,
+// and fall back to memchr. The parsed head refers into the buffer it was
+// parsed from, e.g. the socket_reader view returned by read_until("\r\n\r\n").
+// http_request and http_response are the owned messages the client and the
+// server exchange with their callers.
+namespace awaitable {
+namespace detail {
+inline unsigned lowest_bit(uint32_t mask) noexcept {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return idx;
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+// first position >= pos where the Len bytes of pattern start, scalar
+template<size_t Len>
+size_t find_pattern_scalar(const char* data, size_t size, size_t pos, const char* pattern) {
+    return byte_view(data, size).find(byte_view(pattern, Len), pos);
+}
+
+#if defined(AWAITABLE_HTTP_SSE2)
+// Candidates match the first and the last byte of the pattern, 16 positions
+// per step, the middle bytes are checked only for those.
+template<size_t Len>
+size_t find_pattern_sse2(const char* data, size_t size, size_t pos, const char* pattern) {
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[Len - 1]);
+    while (pos + 16 + Len - 1 <= size) {
+        auto p = data + pos;
+        __m128i hit = _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), first),
+            _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + Len - 1)), last));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+        while (mask) {
+            unsigned bit = lowest_bit(mask);
+            if (Len <= 2 || std::memcmp(p + bit + 1, pattern + 1, Len - 2) == 0)
+                return pos + bit;
+            mask &= mask - 1;
+        }
+        pos += 16;
+    }
+    return find_pattern_scalar<Len>(data, size, pos, pattern);
+}
+#endif
+
+#if defined(AWAITABLE_HTTP_AVX2)
+template<size_t Len>
+size_t find_pattern_avx2(const char* data, size_t size, size_t pos, const char* pattern) {
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[Len - 1]);
+    while (pos + 32 + Len - 1 <= size) {
+        auto p = data + pos;
+        __m256i hit = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), first),
+            _mm256_cmpeq_epi8(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + Len - 1)), last));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        while (mask) {
+            unsigned bit = lowest_bit(mask);
+            if (Len <= 2 || std::memcmp(p + bit + 1, pattern + 1, Len - 2) == 0)
+                return pos + bit;
+            mask &= mask - 1;
+        }
+        pos += 32;
+    }
+    return find_pattern_sse2<Len>(data, size, pos, pattern);
+}
+#endif
+
+template<size_t Len>
+size_t find_pattern(const char* data, size_t size, size_t pos, const char* pattern) {
+#if defined(AWAITABLE_HTTP_AVX2)
+    return find_pattern_avx2<Len>(data, size, pos, pattern);
+#elif defined(AWAITABLE_HTTP_SSE2)
+    return find_pattern_sse2<Len>(data, size, pos, pattern);
+#else
+    return find_pattern_scalar<Len>(data, size, pos, pattern);
+#endif
+}
+}  // namespace detail
+
+// position of the first "\r\n" at or after pos, byte_view::npos if none
+inline size_t find_crlf(byte_view data, size_t pos = 0) noexcept {
+    return detail::find_pattern<2>(data.data(), data.size(), pos, "\r\n");
+}
+
+// position of the first "\r\n\r\n" at or after pos, the end of a message head
+inline size_t find_crlfcrlf(byte_view data, size_t pos = 0) noexcept {
+    return detail::find_pattern<4>(data.data(), data.size(), pos, "\r\n\r\n");
+}
+
+// byte_view::find with the vectorized scanners for the delimiters of HTTP
+inline size_t find_delimiter(byte_view data, byte_view delim, size_t pos = 0) noexcept {
+    if (delim == "\r\n")
+        return find_crlf(data, pos);
+    if (delim == "\r\n\r\n")
+        return find_crlfcrlf(data, pos);
+    return data.find(delim, pos);
+}
+
+struct http_header {
+    byte_view name;
+    byte_view value;
+};
+
+// Status line and headers of a response. Fixed capacity, parsing does not
+// allocate; the views are valid as long as the parsed buffer.
+struct http_response_head {
+    enum : size_t { max_headers = 64 };
+
+    byte_view version;
+    unsigned status = 0;
+    byte_view reason;
+    http_header headers[max_headers];
+    size_t header_count = 0;
+
+    // value of the first header named name, compared case-insensitively
+    byte_view find(byte_view name) const noexcept {
+        for (size_t i = 0; i < header_count; ++i) {
+            if (equal_nocase(headers[i].name, name))
+                return headers[i].value;
+        }
+        return byte_view();
+    }
+
+    // ASCII letters only, '\r' and '-' or '@' and '`' differ
+    static bool equal_nocase(byte_view lhs, byte_view rhs) noexcept {
+        if (lhs.size() != rhs.size())
+            return false;
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            if (lower(lhs[i]) != lower(rhs[i]))
+                return false;
+        }
+        return true;
+    }
+    static char lower(char c) noexcept { return c >= 'A' && c <= 'Z' ? char(c | 0x20) : c; }
+};
+
+// Request line and headers, parsed in place like http_response_head.
+struct http_request_head {
+    enum : size_t { max_headers = 64 };
+
+    byte_view method;
+    byte_view target;
+    byte_view version;
+    http_header headers[max_headers];
+    size_t header_count = 0;
+
+    byte_view find(byte_view name) const noexcept {
+        for (size_t i = 0; i < header_count; ++i) {
+            if (http_response_head::equal_nocase(headers[i].name, name))
+                return headers[i].value;
+        }
+        return byte_view();
+    }
+};
+
+// whether a message with this version and Connection header keeps the
+// connection open afterwards
+inline bool http_keep_alive(byte_view version, byte_view connection) noexcept {
+    if (version == "HTTP/1.0")
+        return http_response_head::equal_nocase(connection, "keep-alive");
+    return !http_response_head::equal_nocase(connection, "close");
+}
+
+// a Content-Length value, false unless it is all digits
+inline bool parse_http_length(byte_view value, uint64_t& length) noexcept {
+    if (value.empty() || value.size() > 19)
+        return false;
+    length = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9')
+            return false;
+        length = length * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+struct http_request {
+    std::string method = "GET";
+    std::string target = "/";
+    // Host, Content-Length and Connection are added by the client
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+struct http_response {
+    unsigned status = 0;
+    // the server fills in the standard phrase when empty
+    std::string reason;
+    std::vector<std::pair<std::string, std::string>> headers;
+    // empty when the body was streamed to a sink
+    std::string body;
+
+    // value of the first header named name, compared case-insensitively
+    const std::string* find(byte_view name) const noexcept {
+        for (auto& h : headers) {
+            if (http_response_head::equal_nocase(h.first, name))
+                return &h.second;
+        }
+        return nullptr;
+    }
+};
+
+inline const char* http_reason(unsigned status) noexcept {
+    switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 411: return "Length Required";
+    case 413: return "Content Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+namespace detail {
+inline byte_view trim_ows(byte_view v) noexcept {
+    size_t b = 0, e = v.size();
+    while (b < e && (v[b] == ' ' || v[b] == '\t'))
+        ++b;
+    while (e > b && (v[e - 1] == ' ' || v[e - 1] == '\t'))
+        --e;
+    return v.substr(b, e - b);
+}
+
+// header lines from pos up to the empty line, false on a malformed line or
+// more than max_headers
+inline bool parse_http_headers(byte_view head, size_t pos, http_header* headers,
+    size_t max_headers, size_t& count) noexcept {
+    count = 0;
+    for (;;) {
+        size_t eol = find_crlf(head, pos);
+        if (eol == byte_view::npos)
+            return false;
+        if (eol == pos)
+            return true;
+        if (count == max_headers)
+            return false;
+        auto line = head.substr(pos, eol - pos);
+        size_t colon = line.find(':');
+        if (colon == byte_view::npos || colon == 0)
+            return false;
+        headers[count].name = line.substr(0, colon);
+        headers[count].value = trim_ows(line.substr(colon + 1));
+        ++count;
+        pos = eol + 2;
+    }
+}
+}  // namespace detail
+
+// head runs from the status line through the empty line, as returned by
+// read_until("\r\n\r\n"). False if it is not a well-formed HTTP/1.x head.
+inline bool parse_http_response_head(byte_view head, http_response_head& out) noexcept {
+    size_t eol = find_crlf(head);
+    if (eol == byte_view::npos)
+        return false;
+    auto line = head.substr(0, eol);
+    // HTTP/1.1 200 OK
+    if (line.size() < 12 || !line.starts_with("HTTP/1.") || line[8] != ' ')
+        return false;
+    out.version = line.substr(0, 8);
+    unsigned status = 0;
+    for (size_t i = 9; i < 12; ++i) {
+        char c = line[i];
+        if (c < '0' || c > '9')
+            return false;
+        status = status * 10 + static_cast<unsigned>(c - '0');
+    }
+    if (line.size() > 12 && line[12] != ' ')
+        return false;
+    out.status = status;
+    out.reason = line.size() > 13 ? line.substr(13) : byte_view();
+    return detail::parse_http_headers(
+        head, eol + 2, out.headers, http_response_head::max_headers, out.header_count);
+}
+
+// GET /index.html HTTP/1.1, then the headers up to the empty line
+inline bool parse_http_request_head(byte_view head, http_request_head& out) noexcept {
+    size_t eol = find_crlf(head);
+    if (eol == byte_view::npos)
+        return false;
+    auto line = head.substr(0, eol);
+    size_t sp1 = line.find(' ');
+    if (sp1 == byte_view::npos || sp1 == 0)
+        return false;
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp2 == byte_view::npos || sp2 == sp1 + 1)
+        return false;
+    out.method = line.substr(0, sp1);
+    out.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    out.version = line.substr(sp2 + 1);
+    if (out.version.size() != 8 || !out.version.starts_with("HTTP/1."))
+        return false;
+    return detail::parse_http_headers(
+        head, eol + 2, out.headers, http_request_head::max_headers, out.header_count);
+}
+}  // namespace awaitable
+#endif  // !defined(AWAITABLE_HTTP_H)
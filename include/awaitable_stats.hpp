@@ -0,0 +1,269 @@
+#ifndef AWAITABLE_STATS_H
+#define AWAITABLE_STATS_H
+
+#pragma once
+
+// Per-task timing, off unless AWAITABLE_TASKS_STATS is defined before
+// awaitable_tasks.hpp is included; without it the hooks are empty macros and
+// co_await stats::name(...) does nothing.
+//
+// Every task frame measures its lifetime from creation to completion, the
+// time it spent suspended in each co_await, and the rest as its running
+// time, in nanoseconds. They go into the histograms of the frame's site: the
+// coroutine function that created it, found by the return address of the
+// frame allocation, or the name the task gave itself with
+//     co_await awaitable::stats::name("fetch");
+// Sites are found and added without locks, recording is three relaxed
+// histogram updates per event.
+#if defined(AWAITABLE_TASKS_STATS)
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include "awaitable_histogram.hpp"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AWAITABLE_NOINLINE __declspec(noinline)
+#define AWAITABLE_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define AWAITABLE_NOINLINE __attribute__((noinline))
+#define AWAITABLE_RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+#if !defined(AWAITABLE_STATS_SITES)
+#define AWAITABLE_STATS_SITES 1024
+#endif
+
+#define AWAITABLE_TIME_FRAME(event, frame) (frame)->_timing.event()
+
+namespace awaitable {
+namespace stats {
+struct site {
+    // the allocating coroutine, or null for a named site
+    const void* address = nullptr;
+    const char* name = nullptr;
+    histogram lifetime;
+    histogram running;
+    // one sample for every co_await that suspended
+    histogram suspended;
+};
+
+namespace detail {
+// open addressing over pointers that are set once, a site lost to a race
+// is deleted by the thread that made it
+class site_table {
+  public:
+    enum : size_t { capacity = AWAITABLE_STATS_SITES };
+    static_assert((capacity & (capacity - 1)) == 0, "site count must be a power of two");
+
+    site_table() {
+        for (auto& slot : _slots)
+            slot.store(nullptr, std::memory_order_relaxed);
+        _overflow.name = "(other)";
+    }
+    ~site_table() {
+        for (auto& slot : _slots)
+            delete slot.load(std::memory_order_relaxed);
+    }
+
+    site* by_address(const void* address) {
+        auto key = reinterpret_cast<uintptr_t>(address);
+        return find(static_cast<size_t>(key ^ (key >> 17)), [address](const site& s) {
+            return !s.name && s.address == address;
+        }, address, nullptr);
+    }
+    // name must stay valid, e.g. a literal
+    site* by_name(const char* name) {
+        uint64_t key = 14695981039346656037ull;
+        for (auto c = name; *c; ++c)
+            key = (key ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+        return find(static_cast<size_t>(key), [name](const site& s) {
+            return s.name && std::strcmp(s.name, name) == 0;
+        }, nullptr, name);
+    }
+
+    template<typename F>
+    void for_each(F&& f) {
+        for (auto& slot : _slots) {
+            if (auto s = slot.load(std::memory_order_acquire))
+                f(*s);
+        }
+        if (_overflow.lifetime.count() || _overflow.suspended.count())
+            f(_overflow);
+    }
+
+  private:
+    template<typename Match>
+    site* find(size_t key, Match match, const void* address, const char* name) {
+        for (size_t n = 0; n < capacity; ++n) {
+            auto& slot = _slots[(key + n) & (capacity - 1)];
+            auto s = slot.load(std::memory_order_acquire);
+            if (!s) {
+                std::unique_ptr<site> fresh(new site());
+                fresh->address = address;
+                fresh->name = name;
+                if (slot.compare_exchange_strong(s, fresh.get(), std::memory_order_acq_rel))
+                    return fresh.release();
+            }
+            if (match(*s))
+                return s;
+        }
+        return &_overflow;
+    }
+
+    std::atomic<site*> _slots[capacity];
+    site _overflow;
+};
+
+inline site_table& sites() {
+    static site_table table;
+    return table;
+}
+
+// from the allocation of a frame to the construction of its promise
+inline site*& allocating_site() noexcept {
+    thread_local site* s = nullptr;
+    return s;
+}
+
+inline uint64_t now() noexcept {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+}  // namespace detail
+
+// a frame's clock, kept in its promise
+class task_timing {
+  public:
+    void create() noexcept {
+        auto& pending = detail::allocating_site();
+        _site = pending ? pending : detail::sites().by_name("(unknown)");
+        pending = nullptr;
+        _created = detail::now();
+    }
+    void suspend() noexcept { _suspended_at = detail::now(); }
+    void resume() noexcept {
+        auto d = detail::now() - _suspended_at;
+        _suspended += d;
+        _site->suspended.record(d);
+    }
+    void complete() noexcept {
+        auto lifetime = detail::now() - _created;
+        _site->lifetime.record(lifetime);
+        _site->running.record(lifetime - _suspended);
+    }
+    void rename(const char* name) { _site = detail::sites().by_name(name); }
+
+  private:
+    site* _site = nullptr;
+    uint64_t _created = 0;
+    uint64_t _suspended_at = 0;
+    uint64_t _suspended = 0;
+};
+
+// operator new of the promise, its caller is the coroutine being created
+inline void* allocate_frame(size_t size, const void* caller) {
+    detail::allocating_site() = detail::sites().by_address(caller);
+    return ::operator new(size);
+}
+
+struct summary {
+    uint64_t count = 0;
+    double mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+};
+
+struct site_snapshot {
+    // the name, or the hex address of the coroutine for addr2line
+    std::string name;
+    summary lifetime;
+    summary running;
+    summary suspended;
+};
+
+inline summary summarize(const histogram& h) {
+    summary s;
+    s.count = h.count();
+    s.mean = h.mean();
+    s.p50 = h.percentile(50);
+    s.p90 = h.percentile(90);
+    s.p99 = h.percentile(99);
+    s.max = h.max();
+    return s;
+}
+
+// every site that recorded something; with reset_after its histograms are
+// cleared, losing what is recorded between the two
+inline std::vector<site_snapshot> snapshot(bool reset_after = false) {
+    std::vector<site_snapshot> all;
+    detail::sites().for_each([&](site& s) {
+        if (!s.lifetime.count() && !s.suspended.count())
+            return;
+        site_snapshot snap;
+        if (s.name) {
+            snap.name = s.name;
+        } else {
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "0x%llx",
+                static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(s.address)));
+            snap.name = buf;
+        }
+        snap.lifetime = summarize(s.lifetime);
+        snap.running = summarize(s.running);
+        snap.suspended = summarize(s.suspended);
+        all.push_back(std::move(snap));
+        if (reset_after) {
+            s.lifetime.reset();
+            s.running.reset();
+            s.suspended.reset();
+        }
+    });
+    return all;
+}
+
+inline void reset() {
+    detail::sites().for_each([](site& s) {
+        s.lifetime.reset();
+        s.running.reset();
+        s.suspended.reset();
+    });
+}
+}  // namespace stats
+}  // namespace awaitable
+#else
+#define AWAITABLE_TIME_FRAME(event, frame) ((void)0)
+#endif  // defined(AWAITABLE_TASKS_STATS)
+
+namespace awaitable {
+namespace stats {
+// co_await stats::name("fetch"); files the calling task under that name
+// from then on, the name must stay valid, e.g. a literal
+struct name {
+    const char* value;
+    explicit name(const char* n) noexcept : value(n) {}
+
+#if defined(AWAITABLE_TASKS_STATS)
+    bool await_ready() const noexcept { return false; }
+    template<typename Handle>
+    bool await_suspend(Handle caller_coro) {
+        caller_coro.promise()._timing.rename(value);
+        return false;
+    }
+#else
+    bool await_ready() const noexcept { return true; }
+    template<typename Handle>
+    void await_suspend(Handle) noexcept {}
+#endif
+    void await_resume() const noexcept {}
+};
+}  // namespace stats
+}  // namespace awaitable
+#endif  // !defined(AWAITABLE_STATS_H)
@@ -5,11 +5,8 @@
 #include <memory>
 #include <experimental/resumable>
 
-#define AWAITABLE_TASKS_TRACE_COROUTINE
-#ifdef AWAITABLE_TASKS_TRACE_COROUTINE
-#define AWAITABLE_TASKS_TRACE(fmt, ...) printf("\n" fmt "\n", ##__VA_ARGS__)
-__declspec(selectany) uint32_t g_frame_count = 0;
-#endif
+#include "awaitable_trace.hpp"
+#include "awaitable_stats.hpp"
 
 #if !defined(_HAS_CXX17) || !_HAS_CXX17
 #include "mpark/variant.hpp"
@@ -128,7 +125,10 @@ struct promise_base {
     promise_base* _prev = nullptr;
     promise_base* _next = nullptr;
     coroutine<> _coro = nullptr;
+    // handle inside the task object owning this frame, kept across list changes
     void* _data = nullptr;
+    // set by states of operations that can be stopped, e.g. the asio adapter
+    void (*_cancel)(promise_base*) = nullptr;
 
     void remove_from_list(bool clear = true) noexcept {
         if (_prev)
@@ -146,12 +146,14 @@ struct promise_base {
             _next->_prev = this;
         target->_next = this;
     }
+    // a task awaited by another keeps its _prev when it awaits again
     void insert_before(promise_base* target) noexcept {
-        AWAITTASK_ASSERT(!_prev);
+        AWAITTASK_ASSERT(!_next && (!_prev || !target->_prev));
         _next = target;
-        _prev = target->_prev;
-        if (_prev)
+        if (target->_prev) {
+            _prev = target->_prev;
             _prev->_next = this;
+        }
         target->_prev = this;
     }
     void replace(promise_base* target) noexcept {
@@ -169,7 +171,6 @@ struct promise_base {
         _prev = nullptr;
         _next = nullptr;
         _coro = nullptr;
-        _data = nullptr;
     }
     static bool is_valid(promise_base* coro_base) noexcept {
         return coro_base && coro_base->_coro && coro_base->_coro;
@@ -177,6 +178,25 @@ struct promise_base {
     static bool is_resumable(promise_base* coro_base) noexcept {
         return is_valid(coro_base) && !coro_base->_coro.done();
     }
+    void cancel() noexcept {
+        if (_cancel)
+            _cancel(this);
+    }
+    static promise_base* innermost(promise_base* target) noexcept {
+        while (target->next())
+            target = target->next();
+        return target;
+    }
+    // detached before it is cancelled, so a completion delivered from the cancel
+    // cannot resume a chain being destroyed. The state may be gone afterwards.
+    bool detach_and_cancel() noexcept {
+        if (!_cancel)
+            return false;
+        auto cancel_op = _cancel;
+        remove_from_list();
+        cancel_op(this);
+        return true;
+    }
     static void destroy_chain(promise_base* target, bool force) {
         if (target) {
             auto outer = target->prev();
@@ -218,6 +238,13 @@ class promise_handle {
     };
     std::shared_ptr<shared_state> _state = std::make_shared<shared_state>();
 
+    promise_handle() = default;
+    explicit promise_handle(std::shared_ptr<shared_state> state) : _state(std::move(state)) {}
+    // shared state allocated through alloc, e.g. the allocator of an asio completion token
+    template<typename Alloc>
+    promise_handle(std::allocator_arg_t, const Alloc& alloc)
+        : _state(std::allocate_shared<shared_state>(alloc)) {}
+
     template<typename U>
     void set_value(U&& value) {
         if (_state) {
@@ -254,7 +281,7 @@ class promise_handle {
             auto& val = _state->value;
             if (NS_VARIANT::get_if<std::exception_ptr>(&val))
                 std::rethrow_exception(NS_VARIANT::get<std::exception_ptr>(val));
-            return NS_VARIANT::get<value_type>(val);
+            return std::move(NS_VARIANT::get<value_type>(val));
         }
     };
 
@@ -273,15 +300,36 @@ class task {
     class promise_type : public promise_base {
       public:
         using result_type = typename value_type;
+        promise_type() noexcept {
+            AWAITABLE_TRACE_FRAME(create, this);
+            AWAITABLE_TIME_FRAME(create, this);
+        }
         promise_type& get_return_object() noexcept { return *this; }
         bool initial_suspend() const { return false; }
+        // An awaited task resumes its caller and is destroyed. One that finished
+        // before it was awaited stays suspended for its task object to read or
+        // destroy, unless the task object is already gone.
         bool final_suspend() noexcept {
+            AWAITABLE_TRACE_FRAME(complete, this);
+            AWAITABLE_TIME_FRAME(complete, this);
             auto coro = prev() ? prev()->_coro : nullptr;
             remove_from_list();
             if (coro) {
                 coro.resume();
+                disown();
+                return false;
             }
-            return false;
+            _finished = _data != nullptr;
+            return _finished;
+        }
+        ~promise_type() {
+            AWAITABLE_TRACE_FRAME(destroy, this);
+            disown();
+        }
+        void disown() noexcept {
+            if (_data)
+                *static_cast<coroutine<promise_type>*>(_data) = nullptr;
+            _data = nullptr;
         }
         template<typename U>
         void return_value(U&& value) noexcept {
@@ -303,24 +351,35 @@ class task {
 
         auto& get_result() noexcept { return result_; }
         NS_VARIANT::variant<detail::mono_state_t, result_type, std::exception_ptr> result_;
-#ifdef AWAITABLE_TASKS_TRACE_COROUTINE
-        using alloc_of_char_type = std::allocator<char>;
-        void* operator new(size_t size) {
-            alloc_of_char_type al;
-            auto ptr = al.allocate(size);
-            AWAITABLE_TASKS_TRACE("promise created %p %u", ptr, ++g_frame_count);
-            return ptr;
+        // suspended at the end, waiting for its task object
+        bool _finished = false;
+#if defined(AWAITABLE_TRACE_AWAITS)
+        template<typename Awaitable>
+        auto await_transform(Awaitable&& awaitable) noexcept {
+            return trace::traced(std::forward<Awaitable>(awaitable), this);
         }
-        void operator delete(void* ptr, size_t size) noexcept {
-            alloc_of_char_type al;
-            AWAITABLE_TASKS_TRACE("promise destroy %p %u", ptr, --g_frame_count);
-            return al.deallocate(static_cast<char*>(ptr), size);
+        stats::name await_transform(stats::name n) noexcept { return n; }
+        void on_await_suspend() noexcept {
+            AWAITABLE_TRACE_FRAME(suspend, this);
+            AWAITABLE_TIME_FRAME(suspend, this);
         }
+        void on_await_resume() noexcept {
+            AWAITABLE_TRACE_FRAME(resume, this);
+            AWAITABLE_TIME_FRAME(resume, this);
+        }
+        // await_suspend returned false, the frame runs on without suspending
+        void on_await_continue() noexcept { AWAITABLE_TRACE_FRAME(resume, this); }
+#endif
+#if defined(AWAITABLE_TASKS_STATS)
+        AWAITABLE_NOINLINE void* operator new(size_t size) {
+            return stats::allocate_frame(size, AWAITABLE_RETURN_ADDRESS());
+        }
+        stats::task_timing _timing;
 #endif
     };
     using coroutine_type = coroutine<promise_type>;
 
-    bool await_ready() noexcept { return false; }
+    bool await_ready() noexcept { return get_coro().promise()._finished; }
     template<typename P>
     void await_suspend(coroutine<P> caller_coro) noexcept {
         AWAITTASK_ASSERT(get_coro().promise().next() || get_coro().promise().prev());
@@ -335,8 +394,9 @@ class task {
         auto coro = coroutine<promise_type>::from_promise(prom);
         set_coro(coro);
         prom._coro = coro;
+        prom._data = &_addr;
     }
-    ~task() = default;
+    ~task() { release(); }
     task() = default;
     task(task const&) = delete;
     task& operator=(task const&) = delete;
@@ -347,18 +407,33 @@ class task {
     }
     task& operator=(task&& rhs) noexcept {
         if (this != std::addressof(rhs)) {
+            release();
             _addr = std::exchange(rhs._addr, nullptr);
+            promise_base* prom = get_promise();
+            if (prom)
+                prom->_data = &_addr;
         }
         return *this;
     }
+    // Cancels the operation the task waits on and destroys its frames at once,
+    // the operation completes later. Memory it still uses must not be in the
+    // frames; a handler_memory is fine, its blocks outlive it. With IOCP that
+    // includes the buffer of a read, use cancel() and let the task end instead.
     void reset() noexcept {
         promise_base* inner = get_promise();
         if (inner) {
-            while (inner->next())
-                inner = inner->next();
-            promise_base::destroy_chain(inner->prev(), true);
+            inner = promise_base::innermost(inner);
+            auto outer = inner->prev();
+            inner->detach_and_cancel();
+            promise_base::destroy_chain(outer, true);
         }
     }
+    // stops the operation the task waits on, the task resumes with its error
+    void cancel() noexcept {
+        promise_base* inner = get_promise();
+        if (inner)
+            promise_base::innermost(inner)->cancel();
+    }
 
     bool is_valid() noexcept { return get_coro() != nullptr; }
 
@@ -372,6 +447,17 @@ class task {
         auto coro = get_coro();
         return coro ? &coro.promise() : nullptr;
     }
+    // a finished frame is destroyed, a running one frees itself when it ends
+    void release() noexcept {
+        auto coro = get_coro();
+        if (!coro)
+            return;
+        if (coro.promise()._finished)
+            coro.destroy();
+        else
+            coro.promise()._data = nullptr;
+        _addr = nullptr;
+    }
     void set_coro(coroutine_type coro) { _addr = detail::horrible_cast<decltype(_addr)>(coro); }
 #if 1
     coroutine_type _addr = nullptr;
@@ -518,14 +604,19 @@ class task_holder {
     task_holder& operator=(const task_holder&) = delete;
     void reset() noexcept {
         if (_base.next()) {
-            promise_base* inner = _base.next();
-            while (inner->next())
-                inner = inner->next();
-            promise_base::destroy_chain(inner->prev(), true);
-            inner->reset();
+            promise_base* inner = promise_base::innermost(&_base);
+            auto outer = inner->prev();
+            bool detached = inner->detach_and_cancel();
+            promise_base::destroy_chain(outer, true);
+            if (!detached)
+                inner->reset();
         }
         _base.reset();
     }
+    void cancel() noexcept {
+        if (_base.next())
+            promise_base::innermost(&_base)->cancel();
+    }
     ~task_holder() noexcept { reset(); }
 
   private:
@@ -566,6 +657,8 @@ typename Ctx::retrun_type when_all(InputIterator first, InputIterator last) {
             if (data.task_count != 0) {
                 data.results[idx] = std::move(a);
                 if (--data.task_count == 0) {
+                    // the finished frames hold ctx, dropped here to break the cycle
+                    auto holders = std::move(data.tasks_holder);
                     data.handle.resume();
                 }
             }
@@ -614,8 +707,11 @@ typename Ctx::retrun_type when_n(InputIterator first, InputIterator last, size_t
             auto& data = *ctx;
             if (data.task_count != 0) {
                 data.set_result(idx, a);
-                if (--data.task_count == 0)
+                if (--data.task_count == 0) {
+                    // the finished frames hold ctx, dropped here to break the cycle
+                    auto holders = std::move(data.tasks_holder);
                     data.handle.resume();
+                }
             }
             return detail::Unkown{};
         }));
@@ -660,8 +756,11 @@ struct when_variadic_context {
     inline void set_variadic_result(T& t) {
         if (task_count != 0) {
             std::get<I>(results) = std::move(t);
-            if (--task_count == 0)
+            if (--task_count == 0) {
+                // the finished frames hold this context, dropped here to break the cycle
+                auto holders = std::move(tasks_holder);
                 handle.resume();
+            }
         }
     }
     promise_handle<detail::Unkown> handle;
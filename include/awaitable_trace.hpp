@@ -0,0 +1,278 @@
+#ifndef AWAITABLE_TRACE_H
+#define AWAITABLE_TRACE_H
+
+#pragma once
+
+// Coroutine frame tracing, off unless AWAITABLE_TASKS_TRACE_COROUTINE is
+// defined before awaitable_tasks.hpp is included; without it the hooks are
+// empty macros and nothing here is compiled.
+//
+// Every thread records into its own ring of the last AWAITABLE_TRACE_RING_EVENTS
+// events: a frame's creation, each suspension and resumption at a co_await,
+// its completion and destruction, stamped with the cycle counter. Recording
+// takes no lock and never allocates after the thread's first event, the
+// ring overwrites its oldest events. The ring of an exited thread keeps its
+// events until a new thread takes it over, so there are never more rings
+// than threads alive at once. write_chrome_trace() copies all rings into a
+// Chrome trace, which chrome://tracing and ui.perfetto.dev open, with a
+// slice per frame for each stretch it ran on a thread.
+#if defined(AWAITABLE_TASKS_TRACE_COROUTINE)
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define AWAITABLE_TRACE_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define AWAITABLE_TRACE_RDTSC 1
+#endif
+
+#if !defined(AWAITABLE_TRACE_RING_EVENTS)
+#define AWAITABLE_TRACE_RING_EVENTS (1u << 15)
+#endif
+
+#define AWAITABLE_TRACE_FRAME(event, frame) \
+    ::awaitable::trace::record(::awaitable::trace::event_##event, frame)
+
+namespace awaitable {
+namespace trace {
+enum event_kind : uint32_t {
+    event_create,
+    event_resume,
+    event_suspend,
+    event_complete,
+    event_destroy,
+};
+
+// the cycle counter where there is one, else nanoseconds
+inline uint64_t ticks() noexcept {
+#if defined(AWAITABLE_TRACE_RDTSC)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+namespace detail {
+// the kind sits in the low byte of the time, frames may be only 4-aligned
+struct slot {
+    std::atomic<uint64_t> stamp;
+    std::atomic<uint64_t> frame;
+};
+
+// Written by its thread only. claimed moves past an event before its slot is
+// overwritten and published after, so a reader can tell the slots it copied
+// while they were being reused.
+struct ring {
+    enum : uint64_t { capacity = AWAITABLE_TRACE_RING_EVENTS };
+    static_assert((capacity & (capacity - 1)) == 0, "ring size must be a power of two");
+
+    explicit ring(uint32_t id) : tid(id) {}
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<uint64_t> published{0};
+    // events before it belong to the thread that had the ring before
+    std::atomic<uint64_t> first{0};
+    std::atomic<uint32_t> tid;
+    slot slots[capacity];
+};
+
+struct registry {
+    registry()
+        : start_ticks(ticks()), start_time(std::chrono::steady_clock::now()) {}
+    std::mutex lock;
+    std::vector<std::unique_ptr<ring>> rings;
+    // rings of exited threads, their events are still dumped until reused
+    std::vector<ring*> unused;
+    uint32_t threads = 0;
+    uint64_t start_ticks;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+inline registry& rings() {
+    static registry r;
+    return r;
+}
+
+inline ring* add_ring() {
+    auto& r = rings();
+    std::lock_guard<std::mutex> guard(r.lock);
+    auto tid = ++r.threads;
+    if (!r.unused.empty()) {
+        auto reused = r.unused.back();
+        r.unused.pop_back();
+        reused->first.store(reused->published.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        reused->tid.store(tid, std::memory_order_relaxed);
+        return reused;
+    }
+    r.rings.emplace_back(new ring(tid));
+    return r.rings.back().get();
+}
+
+// gives the thread's ring back when it exits, later events are dropped
+struct ring_owner {
+    ring* r = add_ring();
+    ~ring_owner() {
+        auto& reg = rings();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        reg.unused.push_back(r);
+        r = nullptr;
+    }
+};
+
+inline ring* local_ring() {
+    thread_local ring_owner owner;
+    return owner.r;
+}
+
+struct event {
+    uint64_t stamp;
+    uint64_t frame;
+};
+}  // namespace detail
+
+inline void record(event_kind kind, const void* frame) noexcept {
+    auto ring = detail::local_ring();
+    if (!ring)
+        return;
+    auto& r = *ring;
+    auto n = r.published.load(std::memory_order_relaxed);
+    r.claimed.store(n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& s = r.slots[n & (detail::ring::capacity - 1)];
+    s.stamp.store((ticks() << 8) | kind, std::memory_order_relaxed);
+    s.frame.store(reinterpret_cast<uintptr_t>(frame), std::memory_order_relaxed);
+    r.published.store(n + 1, std::memory_order_release);
+}
+
+// Writes what the rings hold as Chrome trace JSON. Threads may go on
+// recording meanwhile, their events that were overwritten while copied are
+// left out.
+inline void write_chrome_trace(std::FILE* out) {
+    auto& reg = detail::rings();
+    std::vector<detail::ring*> all;
+    {
+        std::lock_guard<std::mutex> guard(reg.lock);
+        for (auto& r : reg.rings)
+            all.push_back(r.get());
+    }
+    // ticks per microsecond, measured over the life of the registry
+    auto elapsed = std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - reg.start_time).count();
+    auto per_us = elapsed > 0 ? double(ticks() - reg.start_ticks) / elapsed : 1.0;
+    per_us = per_us > 0 ? per_us : 1.0;
+
+    static const char* const names[] = {"create", "resume", "suspend", "complete", "destroy"};
+    std::fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char* sep = "";
+    std::vector<detail::event> events;
+    for (auto r : all) {
+        auto end = r->published.load(std::memory_order_acquire);
+        auto begin = end > detail::ring::capacity ? end - detail::ring::capacity : 0;
+        auto first = r->first.load(std::memory_order_relaxed);
+        begin = begin > first ? begin : first;
+        auto tid = r->tid.load(std::memory_order_relaxed);
+        events.clear();
+        for (auto i = begin; i < end; ++i) {
+            auto& s = r->slots[i & (detail::ring::capacity - 1)];
+            events.push_back(detail::event{s.stamp.load(std::memory_order_relaxed),
+                s.frame.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto claimed = r->claimed.load(std::memory_order_relaxed);
+        // slot i is reused once event i + capacity is claimed
+        auto valid = claimed > detail::ring::capacity ? claimed - detail::ring::capacity : 0;
+        for (auto i = begin > valid ? begin : valid; i < end; ++i) {
+            auto& e = events[static_cast<size_t>(i - begin)];
+            auto kind = static_cast<unsigned>(e.stamp & 0xff);
+            if (kind > event_destroy)
+                continue;
+            auto ts = double(((e.stamp >> 8) - reg.start_ticks) & (~uint64_t(0) >> 8)) / per_us;
+            auto frame = static_cast<unsigned long long>(e.frame);
+            // a frame runs from its creation or resumption to its suspension or completion
+            const char* phase = kind == event_create || kind == event_resume ? "B" :
+                                kind == event_suspend || kind == event_complete ? "E" : "i";
+            std::fprintf(out,
+                "%s{\"name\":\"frame 0x%llx\",\"cat\":\"task\",\"ph\":\"%s\",\"ts\":%.3f,"
+                "\"pid\":1,\"tid\":%u,\"args\":{\"event\":\"%s\"}%s}",
+                sep, frame, phase, ts, tid, names[kind], *phase == 'i' ? ",\"s\":\"t\"" : "");
+            sep = ",\n";
+        }
+    }
+    std::fprintf(out, "\n]}\n");
+}
+
+inline bool write_chrome_trace(const char* path) {
+    std::FILE* out = std::fopen(path, "w");
+    if (!out)
+        return false;
+    write_chrome_trace(out);
+    return std::fclose(out) == 0;
+}
+}  // namespace trace
+}  // namespace awaitable
+#else
+#define AWAITABLE_TRACE_FRAME(event, frame) ((void)0)
+#endif  // defined(AWAITABLE_TASKS_TRACE_COROUTINE)
+
+// With the rings or the task statistics of awaitable_stats.hpp, every
+// co_await of a task is wrapped to tell its frame when it suspends and
+// resumes.
+#if defined(AWAITABLE_TASKS_TRACE_COROUTINE) || defined(AWAITABLE_TASKS_STATS)
+#include <type_traits>
+#include <utility>
+#define AWAITABLE_TRACE_AWAITS 1
+
+namespace awaitable {
+namespace trace {
+// The awaitable is held by reference, it lives until the co_await ends. An
+// await_suspend returning false leaves a suspend and a resume at the same
+// time in the ring, and no sample in the statistics.
+template<typename Awaitable, typename Frame>
+struct traced_awaiter {
+    Awaitable&& inner;
+    Frame* frame;
+    bool suspended;
+
+    bool await_ready() { return inner.await_ready(); }
+    template<typename Handle>
+    auto await_suspend(Handle caller_coro) -> decltype(inner.await_suspend(caller_coro)) {
+        // before the call, another thread may resume the frame inside it
+        suspended = true;
+        frame->on_await_suspend();
+        return suspend(caller_coro,
+            std::is_same<decltype(inner.await_suspend(caller_coro)), bool>());
+    }
+    template<typename Handle>
+    auto suspend(Handle caller_coro, std::false_type) {
+        return inner.await_suspend(caller_coro);
+    }
+    template<typename Handle>
+    bool suspend(Handle caller_coro, std::true_type) {
+        if (inner.await_suspend(caller_coro))
+            return true;
+        suspended = false;
+        frame->on_await_continue();
+        return false;
+    }
+    decltype(auto) await_resume() {
+        if (suspended)
+            frame->on_await_resume();
+        return inner.await_resume();
+    }
+};
+
+template<typename Awaitable, typename Frame>
+traced_awaiter<Awaitable, Frame> traced(Awaitable&& awaitable, Frame* frame) noexcept {
+    return traced_awaiter<Awaitable, Frame>{std::forward<Awaitable>(awaitable), frame, false};
+}
+}  // namespace trace
+}  // namespace awaitable
+#endif
+#endif  // !defined(AWAITABLE_TRACE_H)
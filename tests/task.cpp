@@ -5,9 +5,22 @@
 #include <string>
 #include <iostream>
 #include "../include/awaitable_tasks.hpp"
+#include "../include/awaitable_buffers.hpp"
+#include "../include/awaitable_handler_memory.hpp"
+#include "../include/awaitable_http.hpp"
+#include "../include/awaitable_histogram.hpp"
 #pragma warning(disable : 4100)
 int g_data = 42;
 
+// instances alive, a when_* context that is never freed keeps its results
+struct counted {
+    static int live;
+    counted() { ++live; }
+    counted(const counted&) { ++live; }
+    ~counted() { --live; }
+};
+int counted::live = 0;
+
 int main() {
     using fn = int (*)();
     fn func = []() -> int {
@@ -41,6 +54,26 @@ int main() {
             return xx;
         }(2);
     }
+    // awaiting tasks that finished without suspending, from a nested task
+    {
+        auto finished = [](int v) -> awaitable::task<int> {
+            co_await awaitable::ex::suspend_never{};
+            return v;
+        };
+        awaitable::promise_handle<int> handle;
+        auto nested = [&](int v) -> awaitable::task<int> {
+            int a = co_await finished(v);
+            int b = co_await handle.get_awaitable();
+            return co_await finished(a + b);
+        };
+        auto outer = [&]() -> awaitable::task<int> {
+            int v = co_await nested(1);
+            std::cout << "finished " << v << std::endl;
+            return v;
+        }();
+        handle.set_value(2);
+        handle.resume();
+    }
     {
         awaitable::promise_handle<int> old_task_handle;
         old_task_handle.get_task().then(func);
@@ -177,6 +210,111 @@ int main() {
         handle_b.resume();
         // leave handle_c
     }
+    // when_all and when_any free their context and frames once complete
+    {
+        {
+            awaitable::promise_handle<counted> handle_a;
+            awaitable::promise_handle<counted> handle_b;
+            awaitable::promise_handle<counted> handle_c;
+            awaitable::promise_handle<counted> handle_d;
+            awaitable::task<counted> task_a = handle_a.get_task();
+            awaitable::task<counted> task_b = handle_b.get_task();
+            awaitable::task<counted> task_c = handle_c.get_task();
+            awaitable::task<counted> task_d = handle_d.get_task();
+            auto all = awaitable::when_all(task_a, task_b);
+            auto any = awaitable::when_any(task_c, task_d);
+            handle_a.resume();
+            handle_b.resume();
+            handle_d.resume();
+            handle_c.resume();
+        }
+        std::cout << "live " << counted::live << std::endl;
+    }
+    // buffer slices
+    {
+        auto& pool = awaitable::buffer_pool::local();
+        awaitable::buffer_slice chunk = pool.allocate();
+        memcpy(chunk.data(), "GET /index.html", 15);
+        chunk.resize(15);
+        awaitable::buffer_chain chain;
+        chain.push_back(chunk.slice(0, 4));
+        chain.push_back(chunk.slice(4));
+        chunk.reset();  // chunk stays alive through the chain
+        chain.consume(4);
+        if (chain.count() == 1 && chain[0].view() == "/index.html")
+            std::cout << "ok " << std::endl;
+        chain.clear();
+        std::cout << "cached " << pool.cached() << std::endl;
+    }
+    // handler memory
+    {
+        awaitable::handler_memory memory;
+        awaitable::handler_allocator<void> alloc(memory);
+        for (int i = 0; i < 3; ++i) {
+            // the same block every time once the first handle is gone
+            awaitable::promise_handle<int> handle(std::allocator_arg, alloc);
+            handle.set_value(i);
+        }
+        std::cout << "cached " << memory.cached() << std::endl;
+    }
+    {
+        // a block still used when its handler_memory goes is freed by its user
+        awaitable::promise_handle<int> pending;
+        {
+            awaitable::handler_memory memory;
+            pending = awaitable::promise_handle<int>(
+                std::allocator_arg, awaitable::handler_allocator<void>(memory));
+        }
+        pending.set_value(1);
+        pending = awaitable::promise_handle<int>();
+        std::cout << "outlived" << std::endl;
+    }
+    {
+        // more blocks than slots, the ones from the heap outlive it as well
+        std::vector<awaitable::promise_handle<int>> pending;
+        {
+            awaitable::handler_memory memory;
+            for (size_t i = 0; i < awaitable::handler_memory::slot_count + 2; ++i)
+                pending.emplace_back(
+                    std::allocator_arg, awaitable::handler_allocator<void>(memory));
+        }
+        pending.clear();
+        std::cout << "outlived " << awaitable::handler_memory::slot_count + 2 << std::endl;
+    }
+    // http head
+    {
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+        awaitable::byte_view data(response);
+        size_t end = awaitable::find_crlfcrlf(data);
+        awaitable::http_response_head head;
+        if (awaitable::parse_http_response_head(data.substr(0, end + 4), head))
+            std::cout << head.status << " " << head.find("content-length").to_string() << std::endl;
+    }
+    // http request head
+    {
+        std::string request = "GET /index.html HTTP/1.1\r\nHost: example.com\r\n\r\n";
+        awaitable::http_request_head head;
+        if (awaitable::parse_http_request_head(request, head)) {
+            bool keep_alive = awaitable::http_keep_alive(head.version, head.find("connection"));
+            std::cout << head.target.to_string() << " " << head.find("host").to_string() << " "
+                      << keep_alive << std::endl;
+        }
+    }
+    // header names differ by more than case
+    {
+        std::cout << awaitable::http_response_head::equal_nocase("Keep-Alive", "keep-alive") << " "
+                  << awaitable::http_response_head::equal_nocase("a\r", "a-") << " "
+                  << awaitable::http_response_head::equal_nocase("@", "`") << std::endl;
+    }
+    // histogram
+    {
+        awaitable::histogram latency;
+        for (uint64_t v = 1; v <= 1000; ++v)
+            latency.record(v);
+        // within 1/16 of the exact 500 and 990
+        std::cout << latency.percentile(50) << " " << latency.percentile(99) << " " << latency.max()
+                  << std::endl;
+    }
 #if defined(AWAITTASK_ENABLE_THEN_TASK)
     // do not use
     // then task_gen
@@ -237,6 +375,17 @@ int main() {
         handle_b.resume();
         handle.resume();
     }
+#endif
+#if defined(AWAITABLE_TASKS_TRACE_COROUTINE)
+    // open in chrome://tracing or ui.perfetto.dev
+    awaitable::trace::write_chrome_trace("task_trace.json");
+#endif
+#if defined(AWAITABLE_TASKS_STATS)
+    for (auto& site : awaitable::stats::snapshot()) {
+        std::cout << site.name << " " << site.lifetime.count << " tasks, lifetime p50 "
+                  << site.lifetime.p50 << " ns, running p50 " << site.running.p50 << " ns"
+                  << std::endl;
+    }
 #endif
     return 0;
 }
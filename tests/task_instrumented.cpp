@@ -0,0 +1,92 @@
+// task_instrumented.cpp : the task tests of the instrumented build, the
+// project defines AWAITABLE_TASKS_TRACE_COROUTINE and AWAITABLE_TASKS_STATS.
+//
+
+#include "stdafx.h"
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "../include/awaitable_tasks.hpp"
+#pragma warning(disable : 4100)
+
+static size_t count_of(const std::string& text, const char* what) {
+    size_t n = 0;
+    for (auto pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1))
+        ++n;
+    return n;
+}
+
+static std::string chrome_trace() {
+    std::string text;
+    std::FILE* out = std::tmpfile();
+    if (!out)
+        return text;
+    awaitable::trace::write_chrome_trace(out);
+    std::rewind(out);
+    char buf[4096];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), out)) > 0)
+        text.append(buf, n);
+    std::fclose(out);
+    return text;
+}
+
+// one frame suspended once, created, resumed and destroyed on this thread
+static void suspend_once() {
+    awaitable::promise_handle<int> handle;
+    auto t = [&]() -> awaitable::task<int> {
+        co_await awaitable::stats::name("suspend_once");
+        int v = co_await handle.get_awaitable();
+        return v;
+    }();
+    handle.set_value(1);
+    handle.resume();
+}
+
+// goes on without suspending
+struct no_suspend {
+    bool await_ready() { return false; }
+    template<typename Handle>
+    bool await_suspend(Handle) {
+        return false;
+    }
+    void await_resume() {}
+};
+
+static void never_suspend() {
+    auto t = []() -> awaitable::task<int> {
+        co_await awaitable::stats::name("never_suspend");
+        co_await no_suspend{};
+        co_await no_suspend{};
+        return 0;
+    }();
+}
+
+int main() {
+    suspend_once();
+    auto text = chrome_trace();
+    // expect create 1 suspend 1 resume 1 complete 1 destroy 1
+    std::cout << "create " << count_of(text, "\"event\":\"create\"") << " suspend "
+              << count_of(text, "\"event\":\"suspend\"") << " resume "
+              << count_of(text, "\"event\":\"resume\"") << " complete "
+              << count_of(text, "\"event\":\"complete\"") << " destroy "
+              << count_of(text, "\"event\":\"destroy\"") << std::endl;
+
+    // the second thread takes over the ring of the first one, the rings of
+    // the main thread and one other, expect rings 2
+    std::thread(suspend_once).join();
+    std::thread(suspend_once).join();
+    std::cout << "rings " << awaitable::trace::detail::rings().rings.size() << std::endl;
+    // the main thread's events and the last thread's, expect create 2
+    text = chrome_trace();
+    std::cout << "create " << count_of(text, "\"event\":\"create\"") << std::endl;
+
+    // expect suspend_once 3 tasks 3 suspended, never_suspend 1 tasks 0 suspended
+    never_suspend();
+    for (auto& site : awaitable::stats::snapshot()) {
+        std::cout << site.name << " " << site.lifetime.count << " tasks "
+                  << site.suspended.count << " suspended" << std::endl;
+    }
+    return 0;
+}